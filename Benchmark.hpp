@@ -10,6 +10,9 @@
 
 #include "HashOrderBook.hpp"
 #include <map>
+#include <chrono>
+#include <iostream>
+#include <vector>
 #include <random>
 #include <cmath>
 #include <queue>
@@ -361,4 +364,446 @@ static void RunBenchmarks()
     std::cout << "Book erase time for overflow buckets: " << std::chrono::duration_cast<std::chrono::nanoseconds>(book_erase_end_random3 - book_erase_start_random3).count() /10<< "ns" << std::endl;
 }
 
+//hashing on its own. the book's divide free hash_key against the same depth calculation done with divide instructions
+static void RunHashBenchmarks()
+{
+    std::cout << "Running hash benchmarks..." << std::endl;
+    
+    using Key = size_t;
+    const Key tick_size = 5, mid_price = 100000;
+    const size_t fast_book_size = 10, collision_buckets = 3;
+    using BookType = HashOrderBook<Key, Key, tick_size, fast_book_size, collision_buckets>;
+    auto book = std::make_unique<BookType>(mid_price);
+    
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<Key> dist(mid_price, mid_price + 1000 * tick_size);
+    std::vector<Key> keys(1 << 20);
+    for(auto& key : keys)
+        key = dist(gen);
+    
+    //the divisors are loaded at runtime so the compiler can't turn the divides into multiplies itself
+    volatile Key runtime_tick = tick_size;
+    volatile long runtime_book_size = fast_book_size;
+    const Key tick = runtime_tick;
+    const long book_size = runtime_book_size;
+    
+    size_t checksum = 0;
+    auto start_divide = std::chrono::high_resolution_clock::now();
+    for(auto key : keys)
+    {
+        const long depth = static_cast<long>(fast_book_size / 2) + static_cast<long>((key - mid_price) / tick);
+        long hash = depth % book_size;
+        if(hash < 0)
+            hash += book_size;
+        checksum += static_cast<size_t>(hash) + static_cast<size_t>(depth / book_size);
+    }
+    auto end_divide = std::chrono::high_resolution_clock::now();
+    
+    size_t book_checksum = 0;
+    auto start_reciprocal = std::chrono::high_resolution_clock::now();
+    for(auto key : keys)
+    {
+        size_t hash, collision_bucket;
+        book->hash_key(BookType::Side::ASK, key, hash, collision_bucket);
+        book_checksum += hash + collision_bucket;
+    }
+    auto end_reciprocal = std::chrono::high_resolution_clock::now();
+    
+    if(checksum != book_checksum)
+        std::cerr << "Hash benchmark failed" << std::endl;
+    
+    std::cout << "Divide hash time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_divide - start_divide).count() / (double)keys.size() << "ns" << std::endl;
+    std::cout << "Reciprocal hash time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_reciprocal - start_reciprocal).count() / (double)keys.size() << "ns" << std::endl;
+}
+
+static void RunConstructionBenchmarks()
+{
+    std::cout << "Running construction benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    const size_t book_count = 10000, fast_book_size = 64, collision_buckets = 2;
+    using HeapBookType = HashOrderBook<Key, Key, 1, fast_book_size, collision_buckets>;
+    using ArenaBookType = HashOrderBook<Key, Key, 1, fast_book_size, collision_buckets, false, interleaved_layout, std::pmr::polymorphic_allocator<std::byte>>;
+
+    std::vector<std::unique_ptr<HeapBookType>> heap_books;
+    heap_books.reserve(book_count);
+    auto start_heap = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < book_count; ++i)
+        heap_books.push_back(std::make_unique<HeapBookType>(mid_price));
+    auto end_heap = std::chrono::high_resolution_clock::now();
+
+    //the book itself plus its collision blocks. anything past that falls through to the heap
+    auto start_fault = std::chrono::high_resolution_clock::now();
+    arena_resource arena(book_count * (sizeof(ArenaBookType) + heap_books.front()->getByteSize()));
+    auto end_fault = std::chrono::high_resolution_clock::now();
+
+    std::pmr::polymorphic_allocator<std::byte> allocator(&arena);
+    std::vector<ArenaBookType*> arena_books;
+    arena_books.reserve(book_count);
+    auto start_arena = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < book_count; ++i)
+        arena_books.push_back(std::construct_at(allocator.allocate_object<ArenaBookType>(), mid_price, allocator));
+    auto end_arena = std::chrono::high_resolution_clock::now();
+
+    const size_t arena_bytes = arena.used();
+    for(auto* book : arena_books)
+        allocator.delete_object(book);
+
+    std::cout << "Heap construction time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_heap - start_heap).count() / book_count << "ns per book" << std::endl;
+    std::cout << "Arena pre-fault time: " << std::chrono::duration_cast<std::chrono::microseconds>(end_fault - start_fault).count() << "us for " << arena.capacity() << " bytes" << std::endl;
+    std::cout << "Arena construction time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_arena - start_arena).count() / book_count << "ns per book, " << arena_bytes / book_count << " bytes per book" << std::endl;
+}
+
+//books spread over the heap against books packed into an arena on huge pages. a find in a random book each time,
+//so with thousands of books the page walks dominate
+static void RunPageFootprintBenchmarks()
+{
+    std::cout << "Running page footprint benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    const size_t book_count = 4000, fast_book_size = 64, collision_buckets = 2, page_size = 4096;
+    using HeapBookType = HashOrderBook<Key, Key, 1, fast_book_size, collision_buckets>;
+    using ArenaBookType = HashOrderBook<Key, Key, 1, fast_book_size, collision_buckets, false, interleaved_layout, std::pmr::polymorphic_allocator<std::byte>>;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<Key> level_dist(mid_price - 200, mid_price + 200);
+    std::vector<Key> levels(256);
+    for(auto& level : levels)
+        level = level_dist(gen);
+
+    auto fill = [&](auto& book)
+    {
+        for(auto level : levels)
+            book.insert(level < mid_price ? HeapBookType::Side::BID : HeapBookType::Side::ASK, Key(level), Key(level));
+    };
+
+    std::vector<std::unique_ptr<HeapBookType>> heap_books;
+    for(size_t i = 0; i < book_count; ++i)
+    {
+        heap_books.push_back(std::make_unique<HeapBookType>(mid_price));
+        fill(*heap_books.back());
+    }
+
+    huge_page_resource huge_pages;
+    arena_resource arena(book_count * (sizeof(ArenaBookType) + heap_books.front()->getByteSize()), &huge_pages);
+    std::pmr::polymorphic_allocator<std::byte> allocator(&arena);
+    std::vector<ArenaBookType*> arena_books;
+    for(size_t i = 0; i < book_count; ++i)
+    {
+        arena_books.push_back(allocator.new_object<ArenaBookType>(mid_price));
+        fill(*arena_books.back());
+    }
+
+    std::uniform_int_distribution<size_t> book_dist(0, book_count - 1);
+    std::uniform_int_distribution<size_t> find_dist(0, levels.size() - 1);
+    std::vector<std::pair<size_t, Key>> finds(1 << 20);
+    for(auto& find : finds)
+        find = {book_dist(gen), levels[find_dist(gen)]};
+
+    auto time_finds = [&](auto& books)
+    {
+        size_t found = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for(auto& [book, level] : finds)
+        {
+            Key volume = 0;
+            found += books[book]->find(level < mid_price ? HeapBookType::Side::BID : HeapBookType::Side::ASK, level, volume);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        if(found != finds.size())
+            std::cerr << "Page footprint benchmark failed" << std::endl;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)finds.size();
+    };
+
+    std::cout << "Heap book pages: " << heap_books.front()->getPageCount(page_size) << " x 4k" << std::endl;
+    std::cout << "Arena book pages: " << arena_books.front()->getPageCount(page_size) << " x 4k, "
+              << arena_books.front()->getPageCount(huge_pages.page_size()) << " x " << huge_pages.page_size() / 1024 << "k" << std::endl;
+    std::cout << "Heap book random find time: " << time_finds(heap_books) << "ns" << std::endl;
+    std::cout << "Huge page arena book random find time: " << time_finds(arena_books) << "ns" << std::endl;
+
+    for(auto* book : arena_books)
+        allocator.delete_object(book);
+}
+
+//"change quantity at price" messages. find then erase and insert, against one add_quantity
+static void RunUpsertBenchmarks()
+{
+    std::cout << "Running upsert benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    using BookType = HashOrderBook<Key, long, 1, 256, 2>;
+    BookType find_book(mid_price), upsert_book(mid_price);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<Key> level_dist(mid_price - 300, mid_price - 1);
+    std::uniform_int_distribution<long> delta_dist(-3, 5);
+    std::vector<std::pair<Key, long>> changes(1 << 20);
+    for(auto& change : changes)
+        change = {level_dist(gen), delta_dist(gen)};
+
+    auto start_find = std::chrono::high_resolution_clock::now();
+    for(auto& [level, delta] : changes)
+    {
+        long quantity = 0;
+        if(find_book.find(BookType::Side::BID, level, quantity))
+            find_book.erase(BookType::Side::BID, level);
+        quantity += delta;
+        if(quantity != 0)
+            find_book.insert(BookType::Side::BID, Key(level), long(quantity));
+    }
+    auto end_find = std::chrono::high_resolution_clock::now();
+
+    auto start_upsert = std::chrono::high_resolution_clock::now();
+    for(auto& [level, delta] : changes)
+        upsert_book.add_quantity(BookType::Side::BID, level, delta);
+    auto end_upsert = std::chrono::high_resolution_clock::now();
+
+    if(find_book.size() != upsert_book.size())
+        std::cerr << "Upsert benchmark failed" << std::endl;
+
+    std::cout << "Find, erase and insert time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_find - start_find).count() / (double)changes.size() << "ns" << std::endl;
+    std::cout << "add_quantity time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_upsert - start_upsert).count() / (double)changes.size() << "ns" << std::endl;
+}
+
+//the same few levels updated over and over, by price and through level handles. half the levels are in the overflow
+static void RunHandleBenchmarks()
+{
+    std::cout << "Running level handle benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    using BookType = HashOrderBook<Key, long, 1, 256, 2>;
+    BookType key_book(mid_price), handle_book(mid_price);
+
+    std::vector<Key> levels;
+    std::vector<BookType::bid_level_handle> handles;
+    for(Key level = 1; level <= 4; ++level)
+    {
+        levels.push_back(mid_price - level);
+        levels.push_back(mid_price - 1000 - level * 256); //one overflow bucket
+    }
+    for(Key level : levels)
+    {
+        key_book.insert(BookType::Side::BID, Key(level), 1l);
+        handles.emplace_back();
+        handle_book.insert<BookType::Side::BID>(Key(level), 1l, handles.back());
+    }
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> level_dist(0, levels.size() - 1);
+    std::vector<std::pair<size_t, long>> changes(1 << 20);
+    for(auto& change : changes)
+        change = {level_dist(gen), static_cast<long>(gen() % 100 + 1)};
+
+    auto start_key = std::chrono::high_resolution_clock::now();
+    for(auto& [level, quantity] : changes)
+        key_book.update(BookType::Side::BID, levels[level], [quantity = quantity](long& value) { value = quantity; return true; });
+    auto end_key = std::chrono::high_resolution_clock::now();
+
+    auto start_handle = std::chrono::high_resolution_clock::now();
+    for(auto& [level, quantity] : changes)
+        handle_book.update(handles[level], long(quantity));
+    auto end_handle = std::chrono::high_resolution_clock::now();
+
+    for(Key level : levels)
+    {
+        long key_quantity = 0, handle_quantity = 0;
+        if(!key_book.find(BookType::Side::BID, level, key_quantity) || !handle_book.find(BookType::Side::BID, level, handle_quantity) || key_quantity != handle_quantity)
+            std::cerr << "Level handle benchmark failed" << std::endl;
+    }
+
+    std::cout << "Update by price time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_key - start_key).count() / (double)changes.size() << "ns" << std::endl;
+    std::cout << "Update by handle time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_handle - start_handle).count() / (double)changes.size() << "ns" << std::endl;
+}
+
+//walks the first 64 levels of a side, as a risk check does on every order, with iterators and the visitor.
+//most of them are spread out through the overflow, then a book with them all in the fast book and collision tiers
+static void RunDepthWalkBenchmarks()
+{
+    std::cout << "Running depth walk benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    using BookType = HashOrderBook<Key, long, 1, 256, 2>;
+    BookType book(mid_price);
+    std::map<Key, long, std::greater<Key>> reference;
+
+    for(Key level = 1; level <= 16; ++level)
+    {
+        book.insert(BookType::Side::BID, mid_price - level, 1l);
+        reference.emplace(mid_price - level, 1);
+    }
+    for(Key level = 0; level < 48; ++level)
+    {
+        const Key price = mid_price - 1000 - level * 97;
+        book.insert(BookType::Side::BID, Key(price), 1l);
+        reference.emplace(price, 1);
+    }
+
+    const size_t walks = 1 << 16;
+    long book_total = 0, map_total = 0;
+
+    auto start_book = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+    {
+        for(auto it = book.bid_begin(); it != book.bid_end(); ++it)
+            book_total += it->second;
+    }
+    auto end_book = std::chrono::high_resolution_clock::now();
+
+    long reverse_total = 0;
+    auto start_reverse = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+    {
+        for(auto it = book.bid_rbegin(); it != book.bid_rend(); ++it)
+            reverse_total += it->second;
+    }
+    auto end_reverse = std::chrono::high_resolution_clock::now();
+
+    long visitor_total = 0;
+    auto start_visitor = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+        book.for_each_bid_level([&](Key, long quantity) { visitor_total += quantity; });
+    auto end_visitor = std::chrono::high_resolution_clock::now();
+
+    auto start_map = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+    {
+        for(auto it = reference.begin(); it != reference.end(); ++it)
+            map_total += it->second;
+    }
+    auto end_map = std::chrono::high_resolution_clock::now();
+
+    //the same walks over 64 levels in the fast book and collision tiers, every other tick
+    BookType dense_book(mid_price);
+    for(Key level = 1; level <= 128; level += 2)
+        dense_book.insert(BookType::Side::BID, mid_price - level, 1l);
+    long dense_total = 0, dense_visitor_total = 0;
+
+    auto start_dense = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+    {
+        for(auto it = dense_book.bid_begin(); it != dense_book.bid_end(); ++it)
+            dense_total += it->second;
+    }
+    auto end_dense = std::chrono::high_resolution_clock::now();
+
+    auto start_dense_visitor = std::chrono::high_resolution_clock::now();
+    for(size_t walk = 0; walk < walks; ++walk)
+        dense_book.for_each_bid_level([&](Key, long quantity) { dense_visitor_total += quantity; });
+    auto end_dense_visitor = std::chrono::high_resolution_clock::now();
+
+    if(book_total != map_total || reverse_total != map_total || visitor_total != map_total || dense_total != dense_visitor_total)
+        std::cerr << "Depth walk benchmark failed" << std::endl;
+
+    std::cout << "Book walk time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_book - start_book).count() / (double)(walks * reference.size()) << "ns" << std::endl;
+    std::cout << "Book reverse walk time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_reverse - start_reverse).count() / (double)(walks * reference.size()) << "ns" << std::endl;
+    std::cout << "Book visitor time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_visitor - start_visitor).count() / (double)(walks * reference.size()) << "ns" << std::endl;
+    std::cout << "Map walk time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_map - start_map).count() / (double)(walks * reference.size()) << "ns" << std::endl;
+    std::cout << "Dense book walk time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_dense - start_dense).count() / (double)(walks * dense_book.size()) << "ns" << std::endl;
+    std::cout << "Dense book visitor time per level: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_dense_visitor - start_dense_visitor).count() / (double)(walks * dense_book.size()) << "ns" << std::endl;
+}
+
+//insert and erase of one overflow level against a side already holding thousands of them. each one shifts one chunk
+//of the overflow index and rotates the chunks after it, so this grows with about the square root of the depth
+static void RunOverflowIndexBenchmarks()
+{
+    std::cout << "Running overflow index benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 1000000;
+    using BookType = HashOrderBook<Key, long, 1, 256, 2>;
+    const Key overflow_start = mid_price - 1000; //past the collision buckets
+
+    for(size_t depth : {256ul, 1024ul, 4096ul, 16384ul})
+    {
+        BookType book(mid_price);
+        for(Key level = 0; level < depth; ++level)
+            book.insert(BookType::Side::BID, overflow_start - level * 2, 1l); //even ticks, the odd ones are churned
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<Key> level_dist(0, depth - 1);
+        std::vector<Key> churn(1 << 18);
+        for(auto& level : churn)
+            level = overflow_start - level_dist(gen) * 2 - 1;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for(Key level : churn)
+        {
+            book.insert(BookType::Side::BID, Key(level), 1l);
+            book.erase(BookType::Side::BID, level);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if(book.size() != depth)
+            std::cerr << "Overflow index benchmark failed" << std::endl;
+
+        std::cout << "Overflow insert and erase time at " << depth << " overflow levels: "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)churn.size() << "ns" << std::endl;
+    }
+}
+
+//top 20 levels a side into flat arrays, as a publisher does every few microseconds. snapshot against copying through iterators
+static void RunSnapshotBenchmarks()
+{
+    std::cout << "Running snapshot benchmarks..." << std::endl;
+
+    using Key = size_t;
+    const Key mid_price = 100000;
+    using BookType = HashOrderBook<Key, long, 1, 256, 2>;
+    BookType book(mid_price);
+
+    std::mt19937 gen(42);
+    for(Key level = 1; level <= 400; ++level)
+    {
+        if(gen() % 3 == 0) //a gap
+            continue;
+        book.insert(BookType::Side::BID, mid_price - level, long(level));
+        book.insert(BookType::Side::ASK, mid_price + level, long(level));
+    }
+
+    constexpr size_t depth = 20;
+    std::array<Key, depth> bid_keys{}, ask_keys{};
+    std::array<long, depth> bid_values{}, ask_values{};
+    const size_t snapshots = 1 << 18;
+    long iterator_total = 0, snapshot_total = 0;
+
+    auto start_iterator = std::chrono::high_resolution_clock::now();
+    for(size_t snapshot = 0; snapshot < snapshots; ++snapshot)
+    {
+        size_t level = 0;
+        for(auto it = book.bid_begin(); it != book.bid_end() && level < depth; ++it, ++level)
+        {
+            bid_keys[level] = it->first;
+            bid_values[level] = it->second;
+        }
+        level = 0;
+        for(auto it = book.ask_begin(); it != book.ask_end() && level < depth; ++it, ++level)
+        {
+            ask_keys[level] = it->first;
+            ask_values[level] = it->second;
+        }
+        iterator_total += bid_values[depth - 1] + ask_values[depth - 1];
+    }
+    auto end_iterator = std::chrono::high_resolution_clock::now();
+
+    auto start_snapshot = std::chrono::high_resolution_clock::now();
+    for(size_t snapshot = 0; snapshot < snapshots; ++snapshot)
+    {
+        book.snapshot(BookType::Side::BID, depth, bid_keys, bid_values);
+        book.snapshot(BookType::Side::ASK, depth, ask_keys, ask_values);
+        snapshot_total += bid_values[depth - 1] + ask_values[depth - 1];
+    }
+    auto end_snapshot = std::chrono::high_resolution_clock::now();
+
+    if(iterator_total != snapshot_total)
+        std::cerr << "Snapshot benchmark failed" << std::endl;
+
+    std::cout << "Iterator copy time per book: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_iterator - start_iterator).count() / (double)snapshots << "ns" << std::endl;
+    std::cout << "Snapshot time per book: " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_snapshot - start_snapshot).count() / (double)snapshots << "ns" << std::endl;
+}
+
 #endif /* Benchmark_h */
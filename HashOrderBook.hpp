@@ -10,999 +10,3404 @@
 
 #include <array>
 #include <optional>
-#include <forward_list>
+#include <vector>
 #include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <bit>
+#include <type_traits>
+#include <utility>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <cstring>
+#include <memory_resource>
+#include <new>
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
 
-//concept for key to require == - /
+
+//concept for key to require == < - /
 template<typename KeyType>
 concept KeyConcept = requires(KeyType a, KeyType b)
 {
     { a == b } -> std::same_as<bool>;
+    { a < b } -> std::convertible_to<bool>;
     { a - b } -> std::convertible_to<KeyType>;
     { a / b } -> std::convertible_to<std::size_t>;
 };
 
+//layout policies for the fast book and collision buckets.
+//interleaved keeps the key and value of a level next to each other (the original layout).
+//split keeps keys and values in their own contiguous arrays,
+//so a scan which only needs values doesn't drag the keys through the cache.
+//which levels are present is the book's occupancy bitmap, not something the layout stores
+struct interleaved_layout
+{
+    static constexpr bool split_arrays = false;
+    static constexpr bool inline_collision_tier = false;
+    static constexpr bool sentinel_empty_levels = false;
+    static constexpr bool keyless_tiers = false;
+};
 
-template<KeyConcept Key,
-        class Value,
-        Key tick_size, //small key value to show minimum price movement
-        size_t fast_book_size, //fast book size is size of bid and ask depth combined
-        size_t collision_buckets,
-        bool auto_rehash = false> //rehash if the mid price moves out of the fast book size
-class HashOrderBook
+struct split_layout
 {
-public:
+    static constexpr bool split_arrays = true;
+    static constexpr bool inline_collision_tier = false;
+    static constexpr bool sentinel_empty_levels = false;
+    static constexpr bool keyless_tiers = false;
+};
+
+//embeds the collision levels in the book itself instead of a heap block per bucket.
+//they sit tier by tier straight after the fast book, so a collision lookup is index arithmetic rather than
+//a pointer chase, and a depth walk runs through one contiguous block. e.g. inline_collisions<split_layout>
+template<class Layout = interleaved_layout>
+struct inline_collisions : Layout
+{
+    static constexpr bool inline_collision_tier = true;
+};
+
+//an empty fast book or collision slot holds Value{}, e.g. a quantity of 0, instead of carrying an engaged flag.
+//slots are exactly a key and a value and clearing is a memset. the occupancy bitmap says which levels are in the book,
+//so inserting a Value{} is rejected, and a level set to Value{} through an iterator stays until it is erased.
+template<class Layout = interleaved_layout>
+struct sentinel_levels : Layout
+{
+    static constexpr bool sentinel_empty_levels = true;
+};
+
+//the fast book and collision levels only store values. a level's price is fixed by the hashing mid price and its
+//depth, so it's rebuilt when asked for and only the overflow buckets keep keys.
+//prices have to sit on the tick grid, and iterators hand out the price by value rather than by reference.
+template<class Layout = interleaved_layout>
+struct keyless_levels : Layout
+{
+    static constexpr bool keyless_tiers = true;
+};
+
+enum class BookSide
+{
+    BID,
+    ASK
+};
+
+//unsigned division by a constant as a multiply and shifts (Granlund & Montgomery, 'Division by Invariant Integers
+//using Multiplication'). exact for every 64 bit numerator. powers of two are a plain shift.
+template<std::uint64_t divisor>
+struct reciprocal_divider
+{
+    static_assert(divisor > 0, "divisor must be non-zero");
     
-    enum class Side
-    {
-        BID,
-        ASK
-    };
+    static constexpr bool power_of_two = std::has_single_bit(divisor);
+    static constexpr int shift = 64 - std::countl_zero(divisor - 1); //ceil(log2(divisor))
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 u128; //__extension__ keeps -Wpedantic quiet
     
-    static constexpr Key tick_size_val = tick_size;
-    static constexpr size_t fast_book_size_val = fast_book_size;
-    static constexpr size_t collision_buckets_val = collision_buckets;
-    static constexpr size_t cache_line_size = 128;
-
-private:
-    struct bid_ask_node
+    //2^64 * (2^shift - divisor) / divisor + 1. fits in 64 bits as 2^(shift-1) < divisor
+    static constexpr std::uint64_t multiplier = power_of_two ? 0 :
+        static_cast<std::uint64_t>(((u128(1) << shift) - divisor) * (u128(1) << 64) / divisor + 1);
+#endif
+    
+    static constexpr std::uint64_t divide(std::uint64_t numerator) noexcept
     {
-        std::optional<std::pair<Key, Value>> bid_value;
-        std::optional<std::pair<Key, Value>> ask_value;
-        
-        bid_ask_node() = default;
-        
-        bid_ask_node(Key&& key, Value&& value, Side side)
+        if constexpr (power_of_two)
+            return numerator >> std::countr_zero(divisor);
+        else
         {
-            if(side == Side::BID)
-            {
-                decltype(bid_value) new_node({std::move(key), std::move(value)});
-                bid_value = std::move(new_node);
-            }
-            else
-            {
-                decltype(ask_value) new_node({std::move(key), std::move(value)});
-                ask_value = std::move(new_node);
-            }
+#ifdef __SIZEOF_INT128__
+            const std::uint64_t high = static_cast<std::uint64_t>((u128(multiplier) * numerator) >> 64);
+            return (high + ((numerator - high) >> 1)) >> (shift - 1);
+#else
+            return numerator / divisor;
+#endif
         }
-        bid_ask_node(const bid_ask_node& other) = default;
-        ~bid_ask_node() = default;
-        bid_ask_node& operator=(const bid_ask_node& other) = default;
-        bid_ask_node& operator=(bid_ask_node&& other) noexcept= default;
-    };
+    }
+};
+
+//pooled bump allocator over one block taken from upstream and pre-faulted up front, so books, their collision blocks
+//and overflow buckets can be built without going to the heap. small blocks are rounded up to a power of two and freed
+//ones go on a free list per size. blocks of a page or more (books, a rebuild's temporary side) take their real size,
+//rounded to the largest alignment, and freed ones go on a first fit list. either way they get reused, so overflow
+//buckets can keep growing and shrinking. once the block is used up allocations fall through to upstream.
+//not thread safe, use one arena per thread.
+//e.g. HashOrderBook<long, long, 1, 1024, 4, false, interleaved_layout, std::pmr::polymorphic_allocator<std::byte>> book(100, &arena);
+class arena_resource : public std::pmr::memory_resource
+{
+public:
+    explicit arena_resource(size_t capacity, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+    : _upstream(upstream)
+    , _capacity(capacity)
+    {
+        _begin = static_cast<std::byte*>(_upstream->allocate(_capacity, _page_size));
+        std::memset(_begin, 0, _capacity); //fault every page in now rather than on the first insert
+        _next = _begin;
+    }
+    ~arena_resource() override
+    {
+        _upstream->deallocate(_begin, _capacity, _page_size);
+    }
+    arena_resource(const arena_resource&) = delete;
+    arena_resource& operator=(const arena_resource&) = delete;
     
-    struct bid_ask_collision_node : public bid_ask_node
+    constexpr size_t capacity() const noexcept
     {
-        size_t collision_index;
-        
-        bid_ask_collision_node() = delete;
-        bid_ask_collision_node(Key&& key, Value&& value, Side side, size_t collision_index)
-                : bid_ask_node(std::move(key), std::move(value), side), collision_index(collision_index) {}
-        
-        bid_ask_collision_node(const bid_ask_collision_node& other) = default;
-        ~bid_ask_collision_node() = default;
-    };
+        return _capacity;
+    }
     
+    //bytes carved out of the block so far, including blocks sitting on the free lists
+    constexpr size_t used() const noexcept
+    {
+        return static_cast<size_t>(_next - _begin);
+    }
+
+private:
+    static constexpr size_t _page_size = 4096;
+    static constexpr size_t _max_alignment = 128; //blocks are aligned to their size up to this
+    static constexpr size_t _min_size = 16;
     
-    using list_type = std::forward_list<bid_ask_collision_node>;
+    static constexpr size_t _large_size = _page_size; //from here on blocks aren't rounded to a power of two
     
-    template<size_t buckets>
-    struct collision_bucket
+    struct free_block
     {
-        bid_ask_node first_node;
-        using overflow_bucket_type = std::unique_ptr<list_type>;
-        using bucket_type = std::unique_ptr<std::array<bid_ask_node, buckets>>;
-        bucket_type nodes;
-        overflow_bucket_type overflow_bucket;
-        
-        
-        static constexpr size_t size = sizeof(first_node) + sizeof(nodes) + sizeof(overflow_bucket);
-    private:
-        static constexpr size_t how_many_nodes_per_line = cache_line_size / size;
-        static constexpr size_t remainder = cache_line_size - (size * how_many_nodes_per_line);
-    public:
-        static constexpr size_t padding_size = (size >= cache_line_size ?  0ul   : remainder / how_many_nodes_per_line);
-        
-        std::array<char, padding_size> padding; //padd out the structure so no items wrap over a cache when sitting in array.
-        //this helps with random access. Without it we may need to fetch 2 cache lines instead of 1 if any of the
-        //above members are on either size of the cache line divide.
-        
-        collision_bucket()
-                : nodes(std::make_unique<std::array<bid_ask_node, buckets>>()),
-                  overflow_bucket(std::make_unique<list_type>()) {}
-        ~collision_bucket() = default;
-        collision_bucket(const collision_bucket& other) = default;
+        free_block* next;
     };
     
-    using collision_bucket_type = collision_bucket<collision_buckets>;
-    using bucket_type = std::array<collision_bucket_type, fast_book_size>;
-    alignas(cache_line_size)bucket_type _buckets;
+    struct large_free_block
+    {
+        large_free_block* next;
+        size_t size;
+    };
     
-    Key _hashing_mid_price;
-    size_t _current_mid_index = fast_book_size / 2, _size = 0;
-    std::optional<Key> _best_bid, _best_offer;
-private:
-    constexpr size_t _positiveMod(long x, long mod) const
+    std::pmr::memory_resource* _upstream;
+    size_t _capacity;
+    std::byte* _begin = nullptr;
+    std::byte* _next = nullptr;
+    std::array<free_block*, 64> _free_lists{}; //indexed by log2 of the block size
+    large_free_block* _large_free_list = nullptr;
+    
+    static constexpr bool _is_large(size_t bytes, size_t alignment) noexcept
     {
-        if (mod == 0)[[unlikely]] {
-            throw std::invalid_argument("mod must be non-zero");  // Handle division by zero scenario
-        }
-        long result = x % mod;
-        if (result < 0) {
-            result += mod;
-        }
-        return result;
+        return std::max(bytes, alignment) > _large_size;
     }
     
-    constexpr size_t _calc_collision_bucket(long index, long size) const
+    static constexpr size_t _block_size(size_t bytes, size_t alignment) noexcept
     {
-        if (size == 0)[[unlikely]] {
-            throw std::invalid_argument("size must be non-zero");  // Handle division by zero scenario
-        }
-
-        // For positive indices or zero, perform the normal division
-        if (index >= 0)
-            return static_cast<size_t>(index / size);
-
-        // For negative indices, adjust the bucket calculation
-        return static_cast<size_t>(std::abs(index + 1) / size) + 1;
+        if(_is_large(bytes, alignment)) //every large block is _max_alignment aligned, so sizes keep to multiples of it
+            return (bytes + _max_alignment - 1) / _max_alignment * _max_alignment;
+        return std::bit_ceil(std::max({bytes, alignment, _min_size}));
     }
-
     
-    bid_ask_node* _find_node(Side side, const Key& key, typename collision_bucket_type::overflow_bucket_type& overflow_bucket) noexcept
+    //first free large block that fits. a tail big enough to be a large block itself goes back on the list,
+    //a smaller one to the small block free lists
+    void* _reuse_large(size_t size) noexcept
     {
-        for(auto& node : *overflow_bucket)
+        for(large_free_block** link = &_large_free_list; *link != nullptr; link = &(*link)->next)
         {
-            if(side == Side::BID && node.bid_value.has_value())
-            {
-                if(node.bid_value.value().first == key)
-                    return &node;
-            }
-            else if(side == Side::ASK && node.ask_value.has_value())
-            {
-                if(node.ask_value.value().first == key)
-                    return &node;
-            }
+            large_free_block* block = *link;
+            if(block->size < size)
+                continue;
+            *link = block->next;
+            auto* tail = reinterpret_cast<std::byte*>(block) + size;
+            if(block->size - size > _large_size)
+                _large_free_list = ::new(tail) large_free_block{_large_free_list, block->size - size};
+            else
+                _free_small(tail, block->size - size);
+            return block;
         }
         return nullptr;
     }
     
-    bool _erase_node(Side side, const Key& key, typename collision_bucket_type::overflow_bucket_type& overflow_bucket) noexcept
+    //puts 'size' bytes on the small block free lists, one block for each set bit of the size. large blocks are
+    //_max_alignment aligned and sized in multiples of it, so the tail of one splits into blocks aligned enough for any size
+    void _free_small(std::byte* p, size_t size) noexcept
     {
-        auto before = overflow_bucket->before_begin();
-        for(auto it = overflow_bucket->begin(); it != overflow_bucket->end(); ++it)
+        while(size > 0)
         {
-            bool found = false;
-            if(side == Side::BID && it->bid_value.has_value() && it->bid_value.value().first == key)
-            {
-                it->bid_value.reset();
-                found = true;
-                --_size;
-            }
-            else if(side == Side::ASK && it->ask_value.has_value() && it->ask_value.value().first == key)
-            {
-                it->ask_value.reset();
-                found = true;
-                --_size;
-            }
-                
-            if(!it->bid_value.has_value() && !it->ask_value.has_value())
-                overflow_bucket->erase_after(before);
-            
-            if( found)
-                return true;
-            
-            ++before;
-        
+            const size_t block_size = std::bit_floor(size);
+            free_block*& free_list = _free_lists[std::countr_zero(block_size)];
+            free_list = ::new(p) free_block{free_list};
+            p += block_size;
+            size -= block_size;
         }
-        return false;
     }
     
-    void _update_bbo_and_mid(Side side, const Key& key)
+    //carves size bytes off the end of the used part of the block, nullptr when it doesn't fit
+    void* _bump(size_t size, size_t block_alignment) noexcept
     {
-        bool bid_change = false, offer_change = false;
-        if(side == Side::BID && key > _best_bid)
-        {
-            _best_bid = key;
-            bid_change = true;
-        }
-        else if(side == Side::ASK && key < _best_offer)
-        {
-            _best_offer = key;
-            offer_change = true;
-        }
+        const size_t offset = (block_alignment - reinterpret_cast<std::uintptr_t>(_next) % block_alignment) % block_alignment;
+        if(offset + size > static_cast<size_t>(_begin + _capacity - _next))
+            return nullptr;
+        std::byte* block = _next + offset;
+        _next = block + size;
+        return block;
+    }
+    
+    bool _owns(const void* p) const noexcept
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(p), begin = reinterpret_cast<std::uintptr_t>(_begin);
+        return address >= begin && address < begin + _capacity;
+    }
+    
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if(alignment > _max_alignment)
+            return _upstream->allocate(bytes, alignment);
         
-        if(_best_bid.has_value() && _best_offer.has_value() && (bid_change || offer_change))
-        {
-            const auto new_mid = (_best_bid.value() + _best_offer.value()) / 2;
-            size_t hash, collision_bucket;
-            hash_key(side, new_mid, hash, collision_bucket);
-            if(collision_bucket > 0) //if it moves to far its a wrap around. not sure what to do yet. lets come back to this.
-                throw std::runtime_error("Massive mid point move! Untested functionality!");
-            _current_mid_index = hash;
-        }
-        else if(bid_change && _best_bid.has_value() )
+        const size_t size = _block_size(bytes, alignment);
+        void* block = nullptr;
+        if(_is_large(bytes, alignment))
         {
-            size_t hash, collision_bucket;
-            hash_key(side, _best_bid.value(), hash, collision_bucket);
-            _current_mid_index = hash;
+            block = _reuse_large(size);
+            if(block == nullptr)
+                block = _bump(size, _max_alignment);
         }
-        else if(offer_change && _best_offer.has_value())
+        else
         {
-            size_t hash, collision_bucket;
-            hash_key(side, _best_offer.value(), hash, collision_bucket);
-            _current_mid_index = hash;
+            free_block*& free_list = _free_lists[std::countr_zero(size)];
+            if(free_list != nullptr) //every block of a size has the same alignment so any will do
+            {
+                block = free_list;
+                free_list = free_list->next;
+            }
+            else
+                block = _bump(size, std::min(size, _max_alignment));
         }
+        return block != nullptr ? block : _upstream->allocate(bytes, alignment);
     }
     
-    //calculates the hash based on an offset from the mid and the size of the array
-    constexpr bool _hash_key(Side side, const Key& key, size_t& hash, size_t& collision_bucket, const size_t& hashing_mid_price) const
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
     {
-        const long mid = fast_book_size / 2;
-        const long offset_in_ticks = (key - hashing_mid_price) / tick_size; //can be -ve
-        const long index = mid + offset_in_ticks; //can be -ve
-        hash = _positiveMod(index, fast_book_size); //must always be +ve
-        if((side == Side::BID && index > static_cast<long>(fast_book_size))
-           ||
-           (side == Side::ASK && index < 0))
+        if(!_owns(p))
+            return _upstream->deallocate(p, bytes, alignment);
+        const size_t size = _block_size(bytes, alignment);
+        if(_is_large(bytes, alignment))
+            _large_free_list = ::new(p) large_free_block{_large_free_list, size};
+        else
         {
-            collision_bucket = collision_buckets + 1; //if the price is wrapping too high or too low
-            return false; //we use the collision buckets to store these as the nodes are reserved for lower bid or higher asks
+            free_block*& free_list = _free_lists[std::countr_zero(size)];
+            free_list = ::new(p) free_block{free_list};
         }
-        collision_bucket = _calc_collision_bucket(index, fast_book_size); //also must be +ve
-        return collision_bucket < collision_buckets;
     }
     
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+//hands out whole 2MB pages straight from mmap, for use as an arena_resource's upstream so thousands of books share a
+//handful of TLB entries. tries explicit huge pages first (MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages),
+//then a 2MB aligned mapping with madvise(MADV_HUGEPAGE) for transparent huge pages, then plain pages.
+//e.g. huge_page_resource huge_pages; arena_resource arena(64 << 20, &huge_pages);
+class huge_page_resource : public std::pmr::memory_resource
+{
 public:
-    using value_type = bid_ask_node;
+    static constexpr size_t huge_page_size = 2 << 20;
     
-    HashOrderBook(const Key& hashing_mid_price)
-    : _hashing_mid_price(hashing_mid_price)
-    , _ask_End(this)
-    , _cask_End(this)
-    , _bid_End(this)
-    , _cbid_End(this)
+    enum class page_kind
     {
-        for(auto& bucket : _buckets)
-        {
-            bucket.nodes = std::make_unique<std::array<bid_ask_node, collision_buckets>>();
-            bucket.overflow_bucket = std::make_unique<list_type>();
-        }
+        huge, //MAP_HUGETLB
+        transparent_huge, //madvise'd, the kernel backs it with huge pages when it can
+        normal
+    };
+    
+    //what the last mapping got
+    constexpr page_kind kind() const noexcept
+    {
+        return _kind;
     }
-    ~HashOrderBook() = default;
-    HashOrderBook(const HashOrderBook&) = delete;
     
-    void rehash(const Key& hashing_mid_price)
+    //page size of the last mapping, for sizing TLB footprints, e.g. book.getPageCount(huge_pages.page_size())
+    constexpr size_t page_size() const noexcept
     {
-        bucket_type new_buckets;
-        for(auto& bucket : new_buckets) //fill blank buckets
-        {
-            bucket.nodes = std::make_unique<std::array<bid_ask_node, collision_buckets>>();
-            bucket.overflow_bucket = std::make_unique<list_type>();
-        }
-        _size = 0; //todo: size will update on _insert below. a little odd but ok for now.
-        for(auto& bucket : _buckets) //extract each value from curret buckets and insert into new_buckets
-        {
-            //first node
-            if(bucket.first_node.bid_value.has_value())
-            {
-                auto& key = bucket.first_node.bid_value.value().first;
-                //std::cout << "Bid key: " << key << std::endl;
-                auto& value = bucket.first_node.bid_value.value().second;
-                if(!_insert(Side::BID, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                    throw std::runtime_error("Failed to insert into new buckets");
-            }
-            if(bucket.first_node.ask_value.has_value())
-            {
-                auto& key = bucket.first_node.ask_value.value().first;
-                //std::cout << "Ask key: " << key << std::endl;
-                auto& value = bucket.first_node.ask_value.value().second;
-                if(!_insert(Side::ASK, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                    throw std::runtime_error("Failed to insert into new buckets");
-            }
-            
-            //iterate over nodes
-            for(auto& node: *bucket.nodes)
-            {
-                if(node.bid_value.has_value())
-                {
-                    auto& key = node.bid_value.value().first;
-                    //std::cout << "Bid key: " << key << std::endl;
-                    auto& value = node.bid_value.value().second;
-                    if(!_insert(Side::BID, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                        throw std::runtime_error("Failed to insert into new buckets");
-                }
-                if(node.ask_value.has_value())
-                {
-                    auto& key = node.ask_value.value().first;
-                    //std::cout << "Ask key: " << key << std::endl;
-                    auto& value = node.ask_value.value().second;
-                    if(!_insert(Side::ASK, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                        throw std::runtime_error("Failed to insert into new buckets");
-                }
-            }
-            
-            //overflow buckets
-            for(auto& node: *bucket.overflow_bucket)
-            {
-                if(node.bid_value.has_value())
-                {
-                    auto& key = node.bid_value.value().first;
-                    //std::cout << "Bid key: " << key << std::endl;
-                    auto& value = node.bid_value.value().second;
-                    if(!_insert(Side::BID, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                        throw std::runtime_error("Failed to insert into new buckets");
-                }
-                if(node.ask_value.has_value())
-                {
-                    auto& key = node.ask_value.value().first;
-                    //std::cout << "Ask key: " << key << std::endl;
-                    auto& value = node.ask_value.value().second;
-                    if(!_insert(Side::ASK, std::move(key), std::move(value), new_buckets, hashing_mid_price))
-                        throw std::runtime_error("Failed to insert into new buckets");
-                }
-            }
-        }
-        
-        //no copy assignment or move on std::array. move each individually
-        for(size_t i = 0; i < _buckets.size(); ++i)
-        {
-            _buckets[i].first_node = std::move(new_buckets[i].first_node);
-            _buckets[i].nodes = std::move(new_buckets[i].nodes);
-            _buckets[i].overflow_bucket = std::move(new_buckets[i].overflow_bucket);
-        }
-        _hashing_mid_price = hashing_mid_price;
+        return _kind == page_kind::normal ? _normal_page_size : huge_page_size;
     }
     
-    //calculates the hash based on an offset from the mid and the size of the array
-    constexpr bool hash_key(Side side, const Key& key, size_t& hash, size_t& collision_bucket) const
+    constexpr size_t mapped_bytes() const noexcept
     {
-        return _hash_key(side, key, hash, collision_bucket, _hashing_mid_price);
+        return _mapped_bytes;
     }
+
+private:
+    static constexpr size_t _normal_page_size = 4096;
+    page_kind _kind = page_kind::normal;
+    size_t _mapped_bytes = 0;
     
-    bool getBestBid(Key& key, Value& value)
+    static constexpr size_t _round_up(size_t bytes) noexcept
     {
-        auto k = _best_bid.value();
-        decltype(value) valout;
-        auto ok  = find(Side::BID, key, valout);
-        if(!ok)
-            return false;
-        
-        key = k;
-        value = valout;
-        return true;
+        return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
     }
     
-    const Value& getBestOffer(Key& key, Value& value)
+    void* do_allocate(size_t bytes, size_t alignment) override
     {
-        auto k = _best_offer.value();
-        decltype(value) valout;
-        auto ok  = find(Side::ASK, key, valout);
-        if(!ok)
-            return false;
-        
-        key = k;
-        value = valout;
-        return true;
+        if(alignment > huge_page_size)
+            throw std::bad_alloc();
+        const size_t size = _round_up(bytes);
+#if defined(__linux__) || defined(__APPLE__)
+#ifdef MAP_HUGETLB
+        void* huge = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(huge != MAP_FAILED)
+        {
+            _kind = page_kind::huge;
+            _mapped_bytes += size;
+            return huge;
+        }
+#endif
+        //over map by a huge page so the block can start on a huge page boundary, then give back the ends
+        void* mapping = ::mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED)
+            throw std::bad_alloc();
+        const auto address = reinterpret_cast<std::uintptr_t>(mapping);
+        const auto aligned = (address + huge_page_size - 1) / huge_page_size * huge_page_size;
+        if(aligned > address)
+            ::munmap(mapping, aligned - address);
+        if(const size_t tail = address + huge_page_size - aligned; tail > 0)
+            ::munmap(reinterpret_cast<void*>(aligned + size), tail);
+        void* block = reinterpret_cast<void*>(aligned);
+        _kind = page_kind::normal;
+#ifdef MADV_HUGEPAGE
+        if(::madvise(block, size, MADV_HUGEPAGE) == 0)
+            _kind = page_kind::transparent_huge;
+#endif
+        _mapped_bytes += size;
+        return block;
+#else
+        _kind = page_kind::normal;
+        _mapped_bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+#endif
     }
     
-    constexpr const Value& getMid() const noexcept
+    void do_deallocate(void* p, size_t bytes, [[maybe_unused]] size_t alignment) override
     {
-        return _buckets[_current_mid_index].first_node.key;
+        const size_t size = _round_up(bytes);
+        _mapped_bytes -= size;
+#if defined(__linux__) || defined(__APPLE__)
+        ::munmap(p, size);
+#else
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+#endif
     }
     
-private:
-    bool _insert(Side side, Key&& key, Value&& value, bucket_type& buckets, const Key& hashing_mid_price)
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+//one side of the book. levels are indexed by depth, i.e. the number of ticks 'worse' than the top of the fast book
+//(lower prices for bids, higher prices for asks), so each side gets its own dense ring and the collision buckets
+//always extend in that side's worse price direction.
+template<KeyConcept Key,
+        class Value,
+        Key tick_size, //small key value to show minimum price movement
+        size_t fast_book_size, //fast book size is the number of ticks around the mid covered by the first level
+        size_t collision_buckets,
+        BookSide side,
+        class Layout = interleaved_layout, //how levels are laid out in the fast book and collision buckets
+        class Allocator = std::allocator<std::byte>> //for collision blocks and overflow buckets, e.g. std::pmr::polymorphic_allocator
+class HashOrderBookSide
+{
+public:
+    static constexpr Key tick_size_val = tick_size;
+    static constexpr size_t fast_book_size_val = fast_book_size;
+    static constexpr size_t collision_buckets_val = collision_buckets;
+    static constexpr size_t cache_line_size = 128;
+    static constexpr BookSide side_val = side;
+    
+    static_assert(fast_book_size > 0, "fast_book_size must be non-zero");
+    
+    using layout_type = Layout;
+    using allocator_type = Allocator;
+    
+    //where a level lives: its bucket, tier and, for an overflow level, its place in the overflow bucket. repeated updates
+    //at one price go straight to the level with no hashing or overflow search. a rehash makes the handle stale, a recentre
+    //only if it moved the levels of the handle's bucket
+    class level_handle
     {
-        size_t hash, collision_bucket; //collision bucket of 0 means we are looking in the "first node". Should give us better cache performance
-        _hash_key(side, key, hash, collision_bucket, hashing_mid_price);
-        auto& bucket = buckets[hash];
+    public:
+        level_handle() = default;
         
-        bid_ask_node* node = nullptr;
-          
-        if(collision_bucket == 0) //we're looking in "first_node"
+        const Key& key() const noexcept
         {
-            bool occupied = false;
-            if(side == Side::BID)
-                occupied = bucket.first_node.bid_value.has_value();
-            else
-                occupied = bucket.first_node.ask_value.has_value();
-            
-            if(occupied)
-                return false;
-            
-            node = &bucket.first_node;
+            return _key;
         }
-        else if(collision_bucket -1 < collision_buckets)//were looknig in nodes.
+        
+    private:
+        Key _key{};
+        size_t _hash = 0;
+        size_t _collision_bucket = 0; //past collision_buckets for overflow levels
+        long _collision_index = 0; //overflow levels only
+        size_t _position = 0; //index in the overflow bucket when the handle was made. checked before it's used
+        std::uint64_t _generation = 0; //sides start at 1, so a default handle is always stale
+        std::uint32_t _bucket_generation = 0;
+        friend class HashOrderBookSide;
+    };
+
+private:
+    template<class T>
+    using rebind_alloc = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+    
+    //unique_ptr deleter for memory from the book's allocator
+    template<class T>
+    struct allocator_delete
+    {
+        [[no_unique_address]] rebind_alloc<T> allocator;
+        
+        void operator()(T* p) noexcept
         {
-            auto& nodes = *bucket.nodes;
-            const size_t collision_bucket_index = collision_bucket - 1;
-            node = &nodes[collision_bucket_index];
+            std::destroy_at(p);
+            std::allocator_traits<rebind_alloc<T>>::deallocate(allocator, p, 1);
         }
-        else//if we are using overflow buckets? i.e. collison bucket is larger than the hardcoded allowed
+    };
+    
+    template<class T>
+    using allocated_ptr = std::unique_ptr<T, allocator_delete<T>>;
+    
+    template<class T, class... Args>
+    static allocated_ptr<T> _allocate_unique(const Allocator& allocator, Args&&... args)
+    {
+        rebind_alloc<T> rebound(allocator);
+        T* p = std::allocator_traits<rebind_alloc<T>>::allocate(rebound, 1);
+        try
         {
-            node = _find_node(side, key, bucket.overflow_bucket); //it might be in overflow buckets
-            if(!node)
-            {
-                bucket.overflow_bucket->emplace_front(bid_ask_collision_node(std::move(key), std::move(value), side, collision_bucket));
-                ++_size;
-                return true;
-            }
-            else if(side == Side::BID)
-            {
-                const bool has_value = node->bid_value.has_value();
-                if(has_value)
-                    return false;
-                node->bid_value.value().first = std::move(key);
-                node->bid_value.value().second = std::move(value);
-            }
-            else if(side == Side::ASK)
-            {
-                const bool has_value = node->ask_value.has_value();
-                if(has_value)
-                    return false;
-                node->ask_value.value().first = std::move(key);
-                node->ask_value.value().second = std::move(value);
-            }
-            else
-                return false;
+            std::construct_at(p, std::forward<Args>(args)...);
         }
-        
-        if(!node) //if we did find something in the collisin buckets. error
-            return false;
-        
-        decltype(node->bid_value)* value_ptr = nullptr;
-        if(side == Side::BID)
-            value_ptr = &node->bid_value;
-        else
-            value_ptr = &node->ask_value;
-        
-        if(value_ptr->has_value()) //we already have a value! so is error
-            return false;
-        else
+        catch(...)
         {
-            decltype(node->bid_value) new_value({std::move(key), std::move(value)});
-            *value_ptr = std::move(new_value);
-            _update_bbo_and_mid(side, key);
-            ++_size;
-            return true;
+            std::allocator_traits<rebind_alloc<T>>::deallocate(rebound, p, 1);
+            throw;
         }
+        return allocated_ptr<T>(p, allocator_delete<T>{rebound});
     }
     
-public:
-    bool insert(Side side, Key&& key, Value&& value)
+    struct collision_node
     {
-        return _insert(side, std::move(key), std::move(value), _buckets, _hashing_mid_price);
-    }
+        std::pair<Key, Value> level;
+        long collision_index; //depth / fast_book_size rounded down. -ve for prices better than the top of the fast book
+        
+        collision_node() = delete;
+        collision_node(Key&& key, Value&& value, long collision_index)
+                : level(std::move(key), std::move(value)), collision_index(collision_index) {}
+        
+        collision_node(const collision_node& other) = default;
+        collision_node(collision_node&& other) = default;
+        collision_node& operator=(const collision_node& other) = default;
+        collision_node& operator=(collision_node&& other) = default;
+        ~collision_node() = default;
+    };
     
-    bool find(Side side, const Key& key, Value& value)
+    //levels past the collision tier for one bucket. a bucket holds at most one price per collision index, so the
+    //nodes are kept sorted by it in one contiguous array and looked up with a binary search.
+    //erasing or clearing keeps the capacity, a busy bucket stops going to the allocator once it has grown.
+    struct overflow_store
     {
-        size_t hash, collision_bucket;
-        hash_key(side, key, hash, collision_bucket);
-        auto& bucket = _buckets[hash];
-        
-        bid_ask_node* node = nullptr;
+        std::vector<collision_node, rebind_alloc<collision_node>> nodes;
         
-        if(collision_bucket == 0) //we're looking in "first_node"
+        overflow_store() = default;
+        explicit overflow_store(const Allocator& allocator)
+        : nodes(rebind_alloc<collision_node>(allocator))
         {
-            bool occupied = false;
-            if(side == Side::BID)
-                occupied = bucket.first_node.bid_value.has_value();
-            else
-                occupied = bucket.first_node.ask_value.has_value();
-            
-            if(!occupied)
-                return false;
-            
-            node = &bucket.first_node;
         }
-        else if(collision_bucket -1 < collision_buckets)//were looknig in nodes.
+        
+        auto lower_bound(long collision_index) noexcept
         {
-            auto& nodes = *bucket.nodes;
-            const size_t collision_bucket_index = collision_bucket - 1;
-            node = &nodes[collision_bucket_index];
+            return std::lower_bound(nodes.begin(), nodes.end(), collision_index, [](const collision_node& node, long index)
+            {
+                return node.collision_index < index;
+            });
         }
-        else//if we are using overflow buckets? i.e. collison bucket is larget than the hardcoded allowed
-            node = _find_node(side, key, bucket.overflow_bucket); //it might be in overflow buckets
         
-        if(!node) //if we did find something in the collisin buckets. error
-            return false;
-        
-        if(side == Side::BID && node->bid_value.has_value())
+        auto lower_bound(long collision_index) const noexcept
         {
-            if(key != node->bid_value.value().first)
-                throw std::runtime_error("key mismatch");
-            value = node->bid_value.value().second;
-            return true;
-        }
-        else if(side == Side::ASK && node->ask_value.has_value())
-        {
-            if(key != node->ask_value.value().first)
-                throw std::runtime_error("key mismatch");
-            value = node->ask_value.value().second;
-            return true;
+            return std::lower_bound(nodes.begin(), nodes.end(), collision_index, [](const collision_node& node, long index)
+            {
+                return node.collision_index < index;
+            });
         }
-        else
-            return false;
-    }
-    
-    bool erase(Side side, const Key& key)
-    {
-        size_t hash, collision_bucket;
-        hash_key(side, key, hash, collision_bucket);
-        auto& bucket = _buckets[hash];
         
-        bid_ask_node* node = nullptr; //unfortunately faster than using std::optinal<std::reference_wrapper<bid_ask_node>> and checking if it has value.
-        
-        if(collision_bucket == 0) //we're looking in "first_node"
+        collision_node* find(long collision_index) noexcept
         {
-            bool occupied = false;
-            if(side == Side::BID)
-                occupied = bucket.first_node.bid_value.has_value();
-            else
-                occupied = bucket.first_node.ask_value.has_value();
-            
-            if(!occupied)
-                return false;
-            
-            node = &bucket.first_node;
+            auto it = lower_bound(collision_index);
+            return it != nodes.end() && it->collision_index == collision_index ? &*it : nullptr;
         }
         
-        else if(collision_bucket -1 < collision_buckets)//were looknig in nodes.
+        const collision_node* find(long collision_index) const noexcept
         {
-            auto& nodes = *bucket.nodes;
-            const size_t collision_bucket_index = collision_bucket - 1;
-            node = &nodes[collision_bucket_index];
+            auto it = lower_bound(collision_index);
+            return it != nodes.end() && it->collision_index == collision_index ? &*it : nullptr;
         }
-        else//if we are using overflow buckets? i.e. collison bucket is larget than the hardcoded allowed
-        {
-            return _erase_node(side, key, bucket.overflow_bucket); //it might be in overflow buckets
-        }
-        
-        if(!node) //if we did find something in the collisin buckets. error
-            return false;
         
-        if(side == Side::BID && node->bid_value.has_value())
+        //false if the collision index is already taken
+        bool insert(Key&& key, Value&& value, long collision_index)
         {
-            if(key != node->bid_value.value().first)
-                throw std::runtime_error("key mismatch");
-            
-            node->bid_value.reset();
-            --_size;
+            auto it = lower_bound(collision_index);
+            if(it != nodes.end() && it->collision_index == collision_index)
+                return false;
+            nodes.emplace(it, std::move(key), std::move(value), collision_index);
             return true;
         }
-        else if(side == Side::ASK && node->ask_value.has_value())
+        
+        void erase(const collision_node* node) noexcept
         {
-            if(key != node->ask_value.value().first)
-                throw std::runtime_error("key mismatch");
-            
-            node->ask_value.reset();
-            --_size;
-            return true;
+            nodes.erase(nodes.begin() + (node - nodes.data()));
         }
-        return false;
         
-    }
-    
-    constexpr size_t size() const noexcept
-    {
-        return _size;
-    }
-    
-    size_t getByteSize() const
-    {
-        size_t size = 0;
-        for(auto& bucket : _buckets)
+        void clear() noexcept
         {
-            size += sizeof(bucket.first_node);
-            size += sizeof(bucket.nodes);
-            size += sizeof(bucket.overflow_bucket);
-            for(auto& node : *bucket.nodes)
-            {
-                size += sizeof(node);
-            }
-            for(auto& node : *bucket.overflow_bucket)
-            {
-                size += sizeof(node);
-            }
+            nodes.clear();
         }
-        return size;
-    }
-    
-    void clear()
-    {
-        for(auto& bucket : _buckets)
+        
+        void shrink_to_fit()
         {
-            bucket.first_node.bid_value.reset();
-            bucket.first_node.ask_value.reset();
-            if(bucket.nodes)
-            {
-                for(auto& node : *bucket.nodes)
-                {
-                    node.bid_value.reset();
-                    node.ask_value.reset();
-                }
-            }
-            if(bucket.overflow_bucket)
-            {
-                bucket.overflow_bucket->clear();
-            }
+            nodes.shrink_to_fit();
         }
-        _size = 0;
-        _best_bid.reset();
-        _best_offer.reset();
-    }
-    
-    void clear(const Key& new_mid_price)
-    {
-        clear();
-        _hashing_mid_price = new_mid_price;
-    }
-    
-    friend void RunTests();
-    
-private:
+        
+        auto begin() noexcept { return nodes.begin(); }
+        auto end() noexcept { return nodes.end(); }
+        auto begin() const noexcept { return nodes.begin(); }
+        auto end() const noexcept { return nodes.end(); }
+    };
     
-
-    //enum class IteratorDirection { FORWARD, REVERSE}; sticking to foward iterators for now
-    enum class IteratorConstness { CONST, NON_CONST};
-    template<Side side, /*IteratorDirection direction, */IteratorConstness constness = IteratorConstness::NON_CONST>
-    class Xiterator
+    //every overflow price on a side, best first. a tiered vector: one array cut into ring buffer chunks of chunk_size
+    //keys, all full but the last, so a key is found by position with a shift and a mask. an insert or erase shifts the
+    //keys of one chunk and rotates each chunk after it by a key, O(chunk_size + size / chunk_size) rather than the
+    //O(size) of one sorted array. chunks start small and double once there are as many chunks as keys in one, which
+    //keeps both terms near sqrt(size). chunks emptied by erases are kept, so a steady book stops allocating
+    struct overflow_index
     {
-    private:
-        using book_pointer = std::conditional_t<constness == IteratorConstness::CONST, const HashOrderBook*, HashOrderBook*>;
-        using value_type_pointer = std::conditional_t<constness == IteratorConstness::CONST, const value_type*, value_type*>;
-        using value_type_reference = std::conditional_t<constness == IteratorConstness::CONST, const value_type&, value_type&>;
-        using value = std::conditional_t<constness == IteratorConstness::CONST, const Xiterator, Xiterator>;
-        using pointer = std::conditional_t<constness == IteratorConstness::CONST, const Xiterator*, Xiterator*>;
-        using reference = std::conditional_t<constness == IteratorConstness::CONST, const Xiterator&, Xiterator&>;
-        
-        size_t _index = 0, _collision_bucket = 0;
-        book_pointer _book = nullptr;
-        Side _side = side;
-        //IteratorDirection _direction = direction;
-        bool _isEnd = true;
+        static constexpr size_t first_chunk_size = 16;
+        
+        std::vector<Key, rebind_alloc<Key>> keys; //chunk after chunk
+        std::vector<size_t, rebind_alloc<size_t>> firsts; //where each chunk's first key is in its ring
+        size_t count = 0;
+        size_t chunk_size = first_chunk_size;
+        size_t chunk_mask = first_chunk_size - 1;
         
-        Xiterator(size_t index, size_t collision_bucket, book_pointer book, bool isEnd = false)
-        : _index(index),
-          _collision_bucket(collision_bucket),
-          _book(book),
-          _isEnd(isEnd)
+        overflow_index() = default;
+        explicit overflow_index(const Allocator& allocator)
+        : keys(rebind_alloc<Key>(allocator))
+        , firsts(rebind_alloc<size_t>(allocator))
         {
-            while(!_has_price() && _has_next())
-                this->operator++();
-            if(!_has_price() && !_has_next())
-                _isEnd = true;
         }
         
-        Xiterator(book_pointer book)
-        : _book(book),
-          _isEnd(true)
+        overflow_index(overflow_index&& other) noexcept
+        : keys(std::move(other.keys))
+        , firsts(std::move(other.firsts))
+        , count(std::exchange(other.count, 0))
+        , chunk_size(std::exchange(other.chunk_size, first_chunk_size))
+        , chunk_mask(std::exchange(other.chunk_mask, first_chunk_size - 1))
         {
         }
         
-    public:
-        Xiterator()  = default;
-        // Default copy constructor - used for same type
-        Xiterator(const Xiterator& other) noexcept = default;
+        overflow_index& operator=(overflow_index&&) = delete; //moved by construction, see _swap_by_construction
         
-        Xiterator(Xiterator&& other) noexcept
+        constexpr size_t size() const noexcept { return count; }
+        constexpr bool empty() const noexcept { return count == 0; }
+        constexpr size_t capacity() const noexcept { return firsts.size() * chunk_size; }
+        
+        //index in keys of the offset'th key of chunk 'chunk'
+        size_t _at(size_t chunk, size_t offset) const noexcept
         {
-            _index = std::move(other._index);
-            _collision_bucket = std::move(other._collision_bucket);
-            _book = std::move(other._book);
-            //_direction = std::move(other._direction);
-            _side = std::move(other._side);
-            _isEnd = std::move(other._isEnd);
+            return chunk * chunk_size + ((firsts[chunk] + offset) & chunk_mask);
         }
-
-        // Default copy assignment operator - used for same type
-        Xiterator& operator=(const Xiterator& other) noexcept = default;
-
-        // Prevent cross-direction copying and assignment using a deleted function template
-        template<Side otherSide>
-        Xiterator(const Xiterator<otherSide>&) = delete;
-       
-        template<Side otherSide>
-        Xiterator& operator=(const Xiterator<otherSide>&) = delete;
-        
-        //converter functions to convert form forward to reverse and vice versa
-        //template<IteratorDirection OtherDirection>
-        /*auto get_other_direction() const  noexcept {
-            if constexpr (direction == IteratorDirection::FORWARD) {
-                return Xiterator<Side, IteratorDirection::REVERSE, constness>(_index, _collision_bucket, _book);
-            } else {
-                return Xiterator<Side, IteratorDirection::FORWARD, constness>(_index, _collision_bucket, _book);
-            }
-        }*/
-        
-        auto get_other_side() const noexcept{
-            if constexpr (side == Side::BID) {
-                return Xiterator<Side::ASK, /*direction,*/ constness>(_index, _collision_bucket, _book);
-            } else {
-                return Xiterator<Side::BID, /*direction,*/ constness>(_index, _collision_bucket, _book);
-            }
-        }
-                    
-    private:
         
-        size_t _get_max_collision_bucket(const collision_bucket<collision_buckets>& bucket) const
+        const Key& operator[](size_t position) const noexcept
         {
-            //given the current index what is the max collision bucket in the overflow buckets
-            //const auto& bucket = _book->_buckets[_index].overflow_bucket;
-            
-            auto it = std::max_element(bucket.overflow_bucket->begin(), bucket.overflow_bucket->end(), [](const auto& a, const auto& b)
-            {
-                return a.collision_index < b.collision_index;
-            });
-            if(it != bucket.overflow_bucket->end())
-               return it->collision_index;
-            return 0;
+            return keys[_at(position / chunk_size, position)];
+        }
+        
+        const Key& front() const noexcept
+        {
+            return (*this)[0];
         }
         
-        bool _has_next_overflow_bucket() const //this might be too slow :( but is it worse than possibly adding more overhead on the insert /erase to track say, worst price or max price?
+        //first position pred is false for, the keys being partitioned by it. a search of the chunks' first keys
+        //then one within the chunk
+        template<class Pred>
+        size_t partition_point(Pred&& pred) const
         {
-            //for each overflow bucket starting from the current index if the max collison bucket is larger than the current collion index there must be more.
-            //if we are at the end of the overflow buckets then there are no more
-            if constexpr (side == Side::ASK)
+            size_t low = 0, high = (count + chunk_mask) / chunk_size;
+            while(low < high)
             {
-                for(auto it = _book->buckets.begin() + _index; it != _book->buckets.end(); ++it)
-                {
-                    if(_get_max_collision_bucket(*it) >= _collision_bucket)
-                        return true;
-                }
-                return false;
+                const size_t middle = low + (high - low) / 2;
+                if(pred(keys[_at(middle, 0)]))
+                    low = middle + 1;
+                else
+                    high = middle;
             }
-            else
+            if(low == 0)
+                return 0;
+            
+            const size_t chunk = low - 1, first = firsts[chunk];
+            const Key* block = keys.data() + chunk * chunk_size;
+            size_t begin = 1, end = std::min(count - chunk * chunk_size, chunk_size);
+            while(begin < end)
             {
-                for(auto it = _book->_buckets.rbegin() + (_index + fast_book_size); it != _book->_buckets.rend(); ++it)
-                {
-                    if(_get_max_collision_bucket(*it) >= _collision_bucket)
-                        return true;
-                }
-                return false;
+                const size_t middle = begin + (end - begin) / 2;
+                if(pred(block[(first + middle) & chunk_mask]))
+                    begin = middle + 1;
+                else
+                    end = middle;
             }
+            return chunk * chunk_size + begin;
         }
         
-        bool _has_next() const
+        //room for one more key, so the insert after it can't fail
+        void reserve_one()
         {
-            if(!_book) [[unlikely]]
-                return false;
-            
-            //if we're in fast map or collison bucket territory then there is a possiblity of a next time
-            auto next_index = _index;
-            auto next_collision_bucket = _collision_bucket;
-            _next_index(next_index, next_collision_bucket);
-            
-            if(next_collision_bucket <= collision_buckets)
-                return true;
-            else //otherwise we have to find the max collision bucket in each overflow bucket
-                return _has_next_overflow_bucket();
+            if(count < capacity())
+                return;
+            if(firsts.size() == chunk_size)
+                _widen();
+            keys.resize((firsts.size() + 1) * chunk_size); //first, so a throw from either leaves capacity() as it was
+            firsts.push_back(0);
         }
         
-        
-        constexpr void _next_index(size_t& index, size_t& collision_bucket) const//bool increment)
+        //doubles the chunk size when every chunk is full and there are chunk_size of them. each chunk is rotated so its
+        //ring starts at its first key, then each pair of neighbours already is one sorted chunk of twice the size
+        void _widen() noexcept
         {
-            if(!_book) [[unlikely]]
-                return;
-            if constexpr (side == Side::ASK)
-            {
-                const long next_index = static_cast<long>(index) + 1;
-                index = _book->_positiveMod( next_index, fast_book_size);
-                collision_bucket = _book->_calc_collision_bucket(next_index, fast_book_size);
-            }
-            else
+            const size_t chunks = firsts.size() / 2;
+            for(size_t chunk = 0; chunk < firsts.size(); ++chunk)
             {
-                const long next_index = static_cast<long>(index) - 1;
-                index = _book->_positiveMod(next_index, fast_book_size);
-                collision_bucket = _book->_calc_collision_bucket(next_index, fast_book_size);
+                Key* block = keys.data() + chunk * chunk_size;
+                std::rotate(block, block + firsts[chunk], block + chunk_size);
             }
+            firsts.assign(chunks, 0);
+            chunk_size *= 2;
+            chunk_mask = chunk_size - 1;
         }
         
-        bool _has_price() const
+        //moves the keys at offsets from..to-1 of a chunk up one offset, or from+1..to down one. the ring only wraps
+        //once, so it's a memmove or two and a single key rather than a step per key
+        void _shift(size_t chunk, size_t from, size_t to, bool up) noexcept
         {
-            if(_collision_bucket == 0)
-            {
-                const auto& fn = _book->_buckets[_index].first_node;
-                return fn.bid_value.has_value() || fn.ask_value.has_value();
-            }
-            else if(_collision_bucket <= collision_buckets)
+            Key* block = keys.data() + chunk * chunk_size;
+            const size_t first = firsts[chunk];
+            if(up)
             {
-                const auto collision_index = _collision_bucket - 1;
-                const auto & nodes = *_book->_buckets[_index].nodes;
-                const auto& cb = nodes[collision_index];
-                return cb.bid_value.has_value() || cb.ask_value.has_value();
+                for(size_t offset = to; offset > from; )
+                {
+                    const size_t ring = (first + offset) & chunk_mask; //of the key moved into
+                    if(ring == 0) //from the end of the ring to its start
+                    {
+                        block[0] = block[chunk_mask];
+                        --offset;
+                        continue;
+                    }
+                    const size_t run = std::min(offset - from, ring);
+                    std::move_backward(block + ring - run, block + ring, block + ring + 1);
+                    offset -= run;
+                }
             }
-            else //is overflow bucket
+            else
             {
-                const auto& ob = *_book->_buckets[_index].overflow_bucket;
-                
-                for(const auto& node : ob)
+                for(size_t offset = from; offset < to; )
                 {
-                    if(node.collision_index == _collision_bucket)
-                        return node.bid_value.has_value() || node.ask_value.has_value();
+                    const size_t ring = (first + offset) & chunk_mask;
+                    if(ring == chunk_mask)
+                    {
+                        block[chunk_mask] = block[0];
+                        ++offset;
+                        continue;
+                    }
+                    const size_t run = std::min(to - offset, chunk_mask - ring);
+                    std::move(block + ring + 1, block + ring + 1 + run, block + ring);
+                    offset += run;
                 }
-                return false;
             }
         }
         
-        value_type* _get_value_type() const
+        //after reserve_one. each chunk from the last back to the one after position's takes the last key of the one
+        //before it, then position's chunk shifts the keys after position up into the gap that leaves
+        void insert(size_t position, const Key& key) noexcept
         {
-            if(_collision_bucket == 0)
-            {
-                return &_book->_buckets[_index].first_node;
-            }
-            else if(_collision_bucket <= collision_buckets)
+            const size_t target = position / chunk_size;
+            for(size_t chunk = count / chunk_size; chunk > target; --chunk)
             {
-                const auto collision_index = _collision_bucket - 1;
-                auto& nodes = *_book->_buckets[_index].nodes;
-                return &nodes[collision_index];
-            }
-            else //is overflow bucket
-            {
-                auto& ob = *_book->_buckets[_index].overflow_bucket;
-                
-                for(auto& node : ob)
-                {
-                    if(node.collision_index == _collision_bucket)
-                        return &node;
-                }
-                return nullptr;
+                firsts[chunk] = (firsts[chunk] - 1) & chunk_mask;
+                keys[_at(chunk, 0)] = keys[_at(chunk - 1, chunk_mask)];
             }
+            _shift(target, position % chunk_size, std::min(count - target * chunk_size, chunk_mask), true);
+            keys[_at(target, position)] = key;
+            ++count;
         }
-    public:
-        reference operator++()
+        
+        //the reverse of insert. position's chunk shifts the keys after position down, then each chunk after it hands
+        //its first key to the end of the one before it
+        void erase(size_t position) noexcept
         {
-            if(_book == nullptr) [[unlikely]]
-            {
-                return *this;
-            }
-            
-            while( _has_next())
+            const size_t target = position / chunk_size, last = (count - 1) / chunk_size;
+            _shift(target, position % chunk_size, std::min(count - target * chunk_size, chunk_size) - 1, false);
+            for(size_t chunk = target + 1; chunk <= last; ++chunk)
             {
-                _next_index(_index, _collision_bucket);
-                if(_has_price())
-                    return *this;
+                keys[_at(chunk - 1, chunk_mask)] = keys[_at(chunk, 0)];
+                firsts[chunk] = (firsts[chunk] + 1) & chunk_mask;
             }
-           
-            _isEnd = true;
-            return *this;
+            --count;
         }
-        /*reference operator--()
+        
+        void clear() noexcept
         {
-            if(_book == nullptr) [[unlikely]]
-            {
-                return *this;
-            }
-            
-            for(; _migh_have_next(); _next_index(true))
-            {
-                if(_has_price())
-                    return *this;
-            }
-           
-            _isEnd = true;
-            return *this;
-        }*/
-        //pre-increment
-        value operator++(int)
+            count = 0;
+        }
+        
+        //frees the chunks past the last key
+        void shrink_to_fit()
         {
-            Xiterator tmp = *this;
-            ++(*this);
-            return tmp;
+            const size_t chunks = (count + chunk_size - 1) / chunk_size;
+            firsts.resize(chunks);
+            keys.resize(chunks * chunk_size);
+            firsts.shrink_to_fit();
+            keys.shrink_to_fit();
         }
-        //pre-decrement
-        /*value operator--(int)
+        
+        size_t bytes() const noexcept
         {
-            Xiterator tmp = *this;
-            --(*this);
-            return tmp;
-        }*/
-        constexpr value_type_pointer operator->() const
+            return keys.capacity() * sizeof(Key) + firsts.capacity() * sizeof(size_t);
+        }
+    };
+    
+    //a block of 'count' price levels. the fast book is one block of fast_book_size levels
+    //and each bucket owns a block of collision_buckets levels. the layout policy picks the representation.
+    template<size_t count,
+             bool split = Layout::split_arrays,
+             bool sentinel = Layout::sentinel_empty_levels,
+             bool keyless = Layout::keyless_tiers>
+    struct level_block;
+    
+    //interleaved. key and value of a level share a slot.
+    template<size_t count>
+    struct level_block<count, false, false, false>
+    {
+        std::array<std::optional<std::pair<Key, Value>>, count> levels;
+        
+        constexpr const Key& key(size_t index) const noexcept
         {
-            return _get_value_type();
+            return levels[index]->first;
         }
-        constexpr value_type_reference operator*() const
+        
+        constexpr Value& value(size_t index) noexcept
         {
-            return *_get_value_type();
+            return levels[index]->second;
         }
-        constexpr bool operator==(const Xiterator& rhs) const
+        
+        constexpr const Value& value(size_t index) const noexcept
         {
-            if(_book != rhs._book)
-                return false;
-            if(_isEnd == rhs._isEnd)
-                return true;
-            return _index == rhs._index && _collision_bucket == rhs._collision_bucket;
+            return levels[index]->second;
         }
-        constexpr bool operator!=(const Xiterator& rhs) const
+        
+        void emplace(size_t index, Key&& key, Value&& value)
         {
-            if(_book != rhs._book)
-                return true;
-            if(_isEnd != rhs._isEnd)
-                return true;
-            return _index != rhs._index || _collision_bucket != rhs._collision_bucket;
+            levels[index].emplace(std::move(key), std::move(value));
+        }
+        
+        void reset(size_t index) noexcept
+        {
+            levels[index].reset();
+        }
+        
+        void clear() noexcept
+        {
+            for(auto& level : levels)
+                level.reset();
         }
-        friend class HashOrderBook;
     };
-public:
-    using ask_itertator = Xiterator<Side::ASK>;
-    using const_ask_itertator = Xiterator<Side::ASK, IteratorConstness::NON_CONST>;
-    using bid_itertator = Xiterator<Side::BID>;
-    using const_bid_itertator = Xiterator<Side::BID, IteratorConstness::NON_CONST>;
-private:
-    const ask_itertator _ask_End;
-    const const_ask_itertator _cask_End;
-    const bid_itertator _bid_End;
-    const const_bid_itertator _cbid_End;
-public:
-    
-    const ask_itertator& ask_end()
-    {
-        return _ask_End;
-    }
     
-    const const_ask_itertator& ask_end() const
+    //split. keys and values in separate contiguous arrays.
+    //Key and Value need to be default constructible for this layout.
+    template<size_t count>
+    struct level_block<count, true, false, false>
     {
-        return _cask_End;
-    }
+        std::array<Key, count> keys{};
+        std::array<Value, count> values{};
+        
+        constexpr const Key& key(size_t index) const noexcept
+        {
+            return keys[index];
+        }
+        
+        constexpr Value& value(size_t index) noexcept
+        {
+            return values[index];
+        }
+        
+        constexpr const Value& value(size_t index) const noexcept
+        {
+            return values[index];
+        }
+        
+        void emplace(size_t index, Key&& key, Value&& value)
+        {
+            keys[index] = std::move(key);
+            values[index] = std::move(value);
+        }
+        
+        void reset(size_t) noexcept
+        {
+        }
+        
+        void clear() noexcept
+        {
+        }
+    };
     
-    const bid_itertator& bid_end()
-    {
-        return _bid_End;
-    }
+    //sentinel levels. an empty slot is Value{} so there is no flag to check or pad out
+    static constexpr bool _memset_clear = std::is_arithmetic_v<Key> && std::is_arithmetic_v<Value>;
     
-    const const_bid_itertator& bid_end() const
+    struct sentinel_level
     {
-        return _cbid_End;
-    }
+        Key key;
+        Value value;
+    };
     
-    ask_itertator ask_begin()
+    //interleaved with sentinels. a slot is exactly a key and a value
+    template<size_t count>
+    struct level_block<count, false, true, false>
     {
-        if(_best_offer.has_value())
+        std::array<sentinel_level, count> levels{};
+        
+        constexpr const Key& key(size_t index) const noexcept
         {
-            size_t hash, collision_bucket;
-            hash_key(Side::ASK, _best_offer.value(), hash, collision_bucket);
-            return ask_itertator(hash, collision_bucket, this);
+            return levels[index].key;
         }
-        else
-            return ask_end();
-    }
-    
-    const_ask_itertator ask_begin() const
-    {
-        if(_best_offer.has_value())
+        
+        constexpr Value& value(size_t index) noexcept
         {
-            size_t hash, collision_bucket;
-            hash_key(Side::ASK, _best_offer.value(), hash, collision_bucket);
-            return const_ask_itertator(hash, collision_bucket, this);
+            return levels[index].value;
         }
-        else
-            return ask_end();
-    }
-    
-    bid_itertator bid_begin()
-    {
-        if(_best_bid.has_value())
+        
+        constexpr const Value& value(size_t index) const noexcept
         {
-            size_t hash, collision_bucket;
-            hash_key(Side::BID, _best_bid.value(), hash, collision_bucket);
-            return bid_itertator( hash, collision_bucket, this);
+            return levels[index].value;
         }
-        else
-            return bid_end();
-    }
+        
+        void emplace(size_t index, Key&& key, Value&& value)
+        {
+            levels[index].key = std::move(key);
+            levels[index].value = std::move(value);
+        }
+        
+        void reset(size_t index) noexcept
+        {
+            levels[index].value = Value{};
+        }
+        
+        void clear() noexcept
+        {
+            if constexpr (_memset_clear)
+                std::memset(levels.data(), 0, sizeof(levels));
+            else
+                levels.fill(sentinel_level{});
+        }
+    };
     
-    const_bid_itertator bid_begin() const
+    //split with sentinels. nothing but the keys and values
+    template<size_t count>
+    struct level_block<count, true, true, false>
     {
-        if(_best_bid.has_value())
+        std::array<Key, count> keys{};
+        std::array<Value, count> values{};
+        
+        constexpr const Key& key(size_t index) const noexcept
         {
-            size_t hash, collision_bucket;
-            hash_key(Side::BID, _best_bid.value(), hash, collision_bucket);
-            return const_bid_itertator(hash, collision_bucket, this);
+            return keys[index];
         }
-        else
-            return bid_end();
+        
+        constexpr Value& value(size_t index) noexcept
+        {
+            return values[index];
+        }
+        
+        constexpr const Value& value(size_t index) const noexcept
+        {
+            return values[index];
+        }
+        
+        void emplace(size_t index, Key&& key, Value&& value)
+        {
+            keys[index] = std::move(key);
+            values[index] = std::move(value);
+        }
+        
+        void reset(size_t index) noexcept
+        {
+            values[index] = Value{};
+        }
+        
+        void clear() noexcept
+        {
+            if constexpr (_memset_clear)
+                std::memset(values.data(), 0, sizeof(values));
+            else
+                values.fill(Value{});
+        }
+    };
+    
+    //keyless. values only, the book rebuilds the price from the depth.
+    //with no keys interleaved and split are the same thing
+    template<size_t count, bool split>
+    struct level_block<count, split, false, true>
+    {
+        std::array<Value, count> values{};
+        
+        constexpr Value& value(size_t index) noexcept
+        {
+            return values[index];
+        }
+        
+        constexpr const Value& value(size_t index) const noexcept
+        {
+            return values[index];
+        }
+        
+        void emplace(size_t index, Key&&, Value&& value)
+        {
+            values[index] = std::move(value);
+        }
+        
+        void reset(size_t) noexcept
+        {
+        }
+        
+        void clear() noexcept
+        {
+        }
+    };
+    
+    //keyless with sentinels. nothing but the values
+    template<size_t count, bool split>
+    struct level_block<count, split, true, true>
+    {
+        std::array<Value, count> values{};
+        
+        constexpr Value& value(size_t index) noexcept
+        {
+            return values[index];
+        }
+        
+        constexpr const Value& value(size_t index) const noexcept
+        {
+            return values[index];
+        }
+        
+        void emplace(size_t index, Key&&, Value&& value)
+        {
+            values[index] = std::move(value);
+        }
+        
+        void reset(size_t index) noexcept
+        {
+            values[index] = Value{};
+        }
+        
+        void clear() noexcept
+        {
+            if constexpr (_memset_clear)
+                std::memset(values.data(), 0, sizeof(values));
+            else
+                values.fill(Value{});
+        }
+    };
+    
+    struct no_nodes {};
+    
+    static constexpr bool _inline_collisions = Layout::inline_collision_tier;
+    static constexpr bool _keyless = Layout::keyless_tiers;
+    
+    //prices of fast book and collision levels are built on the fly when keyless, so can't be handed out by reference
+    using key_reference = std::conditional_t<_keyless, Key, const Key&>;
+    
+    using fast_block_type = level_block<fast_book_size>;
+    //every collision level of every bucket, slot = collision index * fast_book_size + hash. only used when inline
+    using inline_block_type = std::conditional_t<_inline_collisions, level_block<fast_book_size * collision_buckets>, no_nodes>;
+    
+    template<size_t buckets>
+    struct collision_bucket
+    {
+        using overflow_bucket_type = overflow_store;
+        using bucket_type = std::conditional_t<_inline_collisions, no_nodes, allocated_ptr<level_block<buckets>>>;
+        [[no_unique_address]] bucket_type nodes; //empty when the collision tier is inline
+        overflow_bucket_type overflow_bucket;
+        
+        
+        static constexpr size_t size = (_inline_collisions ? 0 : sizeof(nodes)) + sizeof(overflow_bucket);
+    private:
+        static constexpr size_t how_many_nodes_per_line = cache_line_size / size;
+        static constexpr size_t remainder = cache_line_size - (size * how_many_nodes_per_line);
+    public:
+        static constexpr size_t padding_size = (size >= cache_line_size ?  0ul   : remainder / how_many_nodes_per_line);
+        
+        std::array<char, padding_size> padding; //padd out the structure so no items wrap over a cache when sitting in array.
+        //this helps with random access. Without it we may need to fetch 2 cache lines instead of 1 if any of the
+        //above members are on either size of the cache line divide.
+        
+        collision_bucket() = default; //no collision block yet, see the HashOrderBookSide constructor
+        //the collision block is allocated on the first insert into it, see _insert_collision_block
+        explicit collision_bucket(const Allocator& allocator)
+        : nodes(_empty_block_ptr(allocator))
+        , overflow_bucket(allocator)
+        {
+        }
+        
+        static bucket_type _empty_block_ptr(const Allocator& allocator) noexcept
+        {
+            if constexpr (_inline_collisions)
+                return {};
+            else
+                return bucket_type(nullptr, allocator_delete<level_block<buckets>>{rebind_alloc<level_block<buckets>>(allocator)});
+        }
+        ~collision_bucket() = default;
+        collision_bucket(const collision_bucket& other) = default;
+        collision_bucket(collision_bucket&& other) noexcept = default;
+    };
+    
+    //one bit per level, set while the level holds a price. every word with a bit set has its own bit set in a summary
+    //bitmap one level up (and so on until a single word), so finding the next set bit is a count trailing zeros
+    //per level of the hierarchy however far away it is.
+    template<size_t bits>
+    struct occupancy_bitmap
+    {
+        static constexpr size_t word_bits = 64;
+        static constexpr size_t word_count = (bits + word_bits - 1) / word_bits;
+        static constexpr bool has_summary = word_count > 1;
+        using summary_type = std::conditional_t<has_summary, occupancy_bitmap<word_count>, no_nodes>;
+        
+        std::array<std::uint64_t, word_count> words{};
+        [[no_unique_address]] summary_type summary; //bit per non zero word
+        
+        constexpr void set(size_t index) noexcept
+        {
+            const size_t word = index / word_bits;
+            if constexpr (has_summary)
+            {
+                if(!words[word])
+                    summary.set(word);
+            }
+            words[word] |= std::uint64_t(1) << (index % word_bits);
+        }
+        
+        constexpr void reset(size_t index) noexcept
+        {
+            const size_t word = index / word_bits;
+            words[word] &= ~(std::uint64_t(1) << (index % word_bits));
+            if constexpr (has_summary)
+            {
+                if(!words[word])
+                    summary.reset(word);
+            }
+        }
+        
+        constexpr bool test(size_t index) const noexcept
+        {
+            return words[index / word_bits] & (std::uint64_t(1) << (index % word_bits));
+        }
+        
+        //first set bit at or after 'from', 'bits' if there are none
+        constexpr size_t find_next(size_t from) const noexcept
+        {
+            size_t word = from / word_bits;
+            if(word >= word_count)
+                return bits;
+            const std::uint64_t masked = words[word] & (~std::uint64_t(0) << (from % word_bits));
+            if(masked)
+                return word * word_bits + std::countr_zero(masked);
+            
+            if constexpr (has_summary)
+            {
+                word = summary.find_next(word + 1);
+                if(word < word_count)
+                    return word * word_bits + std::countr_zero(words[word]);
+            }
+            return bits;
+        }
+        
+        constexpr size_t find_first() const noexcept
+        {
+            return find_next(0);
+        }
+        
+        //fn(index) for each set bit in [from, to) in order, a word at a time. empty words are skipped through the summary.
+        //returns false if fn did, which stops the walk
+        template<class Fn>
+        constexpr bool for_each(size_t from, size_t to, Fn&& fn) const
+        {
+            for(size_t index = find_next(from); index < to; )
+            {
+                const size_t word = index / word_bits;
+                for(std::uint64_t set = words[word] & (~std::uint64_t(0) << (index % word_bits)); set; set &= set - 1)
+                {
+                    const size_t bit = word * word_bits + std::countr_zero(set);
+                    if(bit >= to)
+                        return true;
+                    if(!fn(bit))
+                        return false;
+                }
+                index = find_next((word + 1) * word_bits);
+            }
+            return true;
+        }
+        
+        //last set bit at or before 'from', 'bits' if there are none
+        constexpr size_t find_prev(size_t from) const noexcept
+        {
+            size_t word = from / word_bits;
+            const std::uint64_t masked = words[word] & (~std::uint64_t(0) >> (word_bits - 1 - from % word_bits));
+            if(masked)
+                return word * word_bits + word_bits - 1 - std::countl_zero(masked);
+            
+            if constexpr (has_summary)
+            {
+                if(word > 0)
+                {
+                    word = summary.find_prev(word - 1);
+                    if(word < word_count)
+                        return word * word_bits + word_bits - 1 - std::countl_zero(words[word]);
+                }
+            }
+            return bits;
+        }
+        
+        constexpr void clear() noexcept
+        {
+            words.fill(0);
+            if constexpr (has_summary)
+                summary.clear();
+        }
+    };
+    
+    //the fast book and collision tiers together, indexed by slot (collision bucket * fast_book_size + hash)
+    static constexpr size_t _dense_levels = fast_book_size * (collision_buckets + 1);
+    static constexpr long _last_tier = collision_buckets; //deepest collision bucket, anything past it is overflow
+    
+    using collision_bucket_type = collision_bucket<collision_buckets>;
+    using bucket_type = std::array<collision_bucket_type, fast_book_size>;
+    using collision_block_pointer = typename collision_bucket_type::bucket_type; //no_nodes when inline
+    using occupancy_type = occupancy_bitmap<_dense_levels>;
+    alignas(cache_line_size) fast_block_type _fast_book; //first level for every bucket. contiguous so a depth scan stays dense
+    [[no_unique_address]] inline_block_type _collision_book; //the rest of the dense levels, when the collision tier is inline
+    alignas(cache_line_size) bucket_type _buckets;
+    [[no_unique_address]] Allocator _allocator;
+    //the last collision block to empty, kept for the next bucket that needs one so a level moving in and out of
+    //the collision tier doesn't go to the allocator every time
+    [[no_unique_address]] collision_block_pointer _spare_block;
+    //every overflow price, best first, so the crossed prices are the first _crossed_size of them. iterators step
+    //through the overflow with it instead of searching the buckets, and the best overflow price is the front
+    overflow_index _overflow_keys;
+    
+    Key _hashing_mid_price;
+    //the fast book is a ring. this is the bucket holding depth 0, i.e. hash = (depth + ring offset) % fast_book_size.
+    //moving the hashing mid price a tick only moves the ring offset and the one bucket which changes tier
+    size_t _ring_offset = 0;
+    size_t _size = 0;
+    size_t _crossed_size = 0; //levels better than the top of the fast book. they live in the overflow buckets
+    std::optional<Key> _best;
+    occupancy_type _occupied; //which fast book and collision levels hold a price. finds the next best price after an erase
+    std::uint64_t _generation = 1; //bumped by a rehash, swap or clear with a new mid price, which makes every level_handle stale
+    //bumped when a window step moves a bucket's levels, which makes only the level_handles into that bucket stale
+    std::array<std::uint32_t, fast_book_size> _bucket_generations{};
+    
+    //depth of the hashing mid price. bids and asks share the same window of prices in the fast book,
+    //each side just counts from its own end of it.
+    static constexpr long _mid_depth = side == BookSide::ASK ? fast_book_size / 2 : fast_book_size - 1 - fast_book_size / 2;
+private:
+    static constexpr bool _power_of_two_tick() noexcept
+    {
+        if constexpr (std::is_integral_v<Key>)
+            return tick_size > 0 && std::has_single_bit(static_cast<std::make_unsigned_t<Key>>(tick_size));
+        else
+            return false;
+    }
+    
+    static constexpr int _tick_shift() noexcept
+    {
+        if constexpr (_power_of_two_tick())
+            return std::countr_zero(static_cast<std::make_unsigned_t<Key>>(tick_size));
+        else
+            return 0;
+    }
+    
+    //power of two sizes hash with shifts and masks instead of divides, anything else with a multiply by the reciprocal
+    static constexpr bool _power_of_two_book = std::has_single_bit(fast_book_size);
+    static constexpr int _book_shift = std::countr_zero(fast_book_size);
+    using book_divider = reciprocal_divider<fast_book_size>;
+    
+    static constexpr std::uint64_t _tick_divisor() noexcept
+    {
+        if constexpr (std::is_integral_v<Key>)
+            return static_cast<std::uint64_t>(tick_size);
+        else
+            return 1;
+    }
+    
+    //depth modulo fast_book_size, always +ve
+    static constexpr size_t _positiveMod(long depth) noexcept
+    {
+        if constexpr (_power_of_two_book)
+            return static_cast<size_t>(depth) & (fast_book_size - 1); //two's complement so -ve depths wrap correctly
+        else
+            return static_cast<size_t>(depth - _floor_div(depth) * static_cast<long>(fast_book_size));
+    }
+    
+    //depth / fast_book_size rounded down, so -ve depths get -ve tiers
+    static constexpr long _floor_div(long depth) noexcept
+    {
+        if constexpr (_power_of_two_book)
+            return depth >> _book_shift; //arithmetic shift
+        else
+        {
+            if(depth >= 0)
+                return static_cast<long>(book_divider::divide(static_cast<std::uint64_t>(depth)));
+            return -static_cast<long>(book_divider::divide(static_cast<std::uint64_t>(static_cast<long>(fast_book_size) - 1 - depth)));
+        }
+    }
+    
+    //whole ticks in a +ve price difference
+    static constexpr long _ticks(const Key& difference) noexcept
+    {
+        if constexpr (_power_of_two_tick())
+            return static_cast<long>(difference >> _tick_shift());
+        else if constexpr (std::is_integral_v<Key>)
+            return static_cast<long>(reciprocal_divider<_tick_divisor()>::divide(static_cast<std::uint64_t>(difference)));
+        else
+            return static_cast<long>(difference / tick_size);
+    }
+    
+    //whole ticks in a +ve price difference, rounded up
+    static constexpr long _ticks_up(const Key& difference) noexcept
+    {
+        const long ticks = _ticks(difference);
+        return static_cast<Key>(ticks) * tick_size < difference ? ticks + 1 : ticks;
+    }
+    
+    //signed number of ticks 'key' is worse than 'reference', rounded down. done on the absolute difference so unsigned
+    //keys don't wrap. rounding down rather than towards zero moves every price's depth by exactly one when the
+    //reference moves a tick, whether or not the price is on the reference's tick grid
+    static constexpr long _ticks_worse(const Key& key, const Key& reference) noexcept
+    {
+        const bool worse = side == BookSide::ASK ? reference < key : key < reference;
+        if(worse)
+            return _ticks(side == BookSide::ASK ? key - reference : reference - key);
+        return -_ticks_up(side == BookSide::ASK ? reference - key : key - reference);
+    }
+    
+    //true if a is a better price than b for this side
+    static constexpr bool _is_better(const Key& a, const Key& b) noexcept
+    {
+        if constexpr (side == BookSide::BID)
+            return b < a;
+        else
+            return a < b;
+    }
+    
+    //block holding the collision levels of bucket 'hash', and the slot of a (0 based) collision index within it
+    constexpr auto& _collision_block(size_t hash) noexcept
+    {
+        if constexpr (_inline_collisions)
+            return _collision_book;
+        else
+            return *_buckets[hash].nodes;
+    }
+    
+    constexpr const auto& _collision_block(size_t hash) const noexcept
+    {
+        if constexpr (_inline_collisions)
+            return _collision_book;
+        else
+            return *_buckets[hash].nodes;
+    }
+    
+    //collision block of bucket 'hash' for an insert. allocated, or taken from the spare, on first use
+    auto& _insert_collision_block(size_t hash)
+    {
+        if constexpr (!_inline_collisions)
+        {
+            auto& nodes = _buckets[hash].nodes;
+            if(!nodes)
+                nodes.reset(_spare_block ? _spare_block.release()
+                                         : _allocate_unique<level_block<collision_buckets>>(_allocator).release());
+        }
+        return _collision_block(hash);
+    }
+    
+    //gives back bucket 'hash''s collision block once it holds no levels. the first one becomes the spare
+    void _release_collision_block(size_t hash) noexcept
+    {
+        if constexpr (!_inline_collisions)
+        {
+            for(size_t collision_bucket = 1; collision_bucket <= collision_buckets; ++collision_bucket)
+            {
+                if(_occupied.test(collision_bucket * fast_book_size + hash))
+                    return;
+            }
+            if(_spare_block)
+                _buckets[hash].nodes.reset();
+            else
+                _spare_block.reset(_buckets[hash].nodes.release());
+        }
+    }
+    
+    //swaps by move construction. a book's allocator travels with its storage, which pmr allocators (can't be assigned)
+    //and the vectors using them (swap needs equal allocators) only allow through construction
+    template<class T>
+    static void _swap_by_construction(T& a, T& b) noexcept
+    {
+        T moved(std::move(a));
+        std::destroy_at(&a);
+        std::construct_at(&a, std::move(b));
+        std::destroy_at(&b);
+        std::construct_at(&b, std::move(moved));
+    }
+    
+    static constexpr size_t _collision_slot(size_t hash, size_t collision_bucket_index) noexcept
+    {
+        if constexpr (_inline_collisions)
+            return collision_bucket_index * fast_book_size + hash;
+        else
+            return collision_bucket_index;
+    }
+    
+    //ticks from the top of the fast book. -ve for prices better than it
+    constexpr long _depth(const Key& key) const noexcept
+    {
+        return _mid_depth + _ticks_worse(key, _hashing_mid_price);
+    }
+    
+    //depth of a bucket and collision bucket (tier) pair, undoing the ring offset
+    constexpr long _depth_of(size_t hash, long collision_bucket) const noexcept
+    {
+        return collision_bucket * static_cast<long>(fast_book_size) + static_cast<long>(_positiveMod(static_cast<long>(hash) - static_cast<long>(_ring_offset)));
+    }
+    
+    //depth of a fast book or collision slot, i.e. collision bucket * fast_book_size + hash
+    constexpr long _slot_depth(size_t slot) const noexcept
+    {
+        return _depth_of(_positiveMod(static_cast<long>(slot)), _floor_div(static_cast<long>(slot)));
+    }
+    
+    //collision index of a price in its bucket's overflow store, i.e. depth / fast_book_size rounded down
+    long _overflow_index(const Key& key) const noexcept
+    {
+        return _floor_div(_depth(key));
+    }
+    
+    //looks up key in an overflow store. throws if its slot holds a different price, same as the blocks
+    template<class Store>
+    auto* _find_node(const Key& key, Store& overflow_bucket) const
+    {
+        auto* node = overflow_bucket.find(_overflow_index(key));
+        if(node && key != node->level.first)
+            throw std::runtime_error("key mismatch");
+        return node;
+    }
+    
+    bool _erase_node(const Key& key, overflow_store& overflow_bucket)
+    {
+        const collision_node* node = _find_node(key, overflow_bucket);
+        if(!node)
+            return false;
+        _erase_overflow(overflow_bucket, node);
+        return true;
+    }
+    
+    //position of the first price in the overflow index no better than key
+    size_t _overflow_key_position(const Key& key) const noexcept
+    {
+        return _overflow_keys.partition_point([&](const Key& indexed)
+        {
+            return _is_better(indexed, key);
+        });
+    }
+    
+    //takes a level out of its overflow bucket and the overflow index
+    void _erase_overflow(overflow_store& overflow_bucket, const collision_node* node) noexcept
+    {
+        const size_t position = _overflow_key_position(node->level.first);
+        if(position < _crossed_size)
+            --_crossed_size;
+        _overflow_keys.erase(position);
+        overflow_bucket.erase(node);
+        --_size;
+    }
+    
+    //price at the given depth from the hashing mid price. exact for prices on the tick grid
+    constexpr Key _key_at_depth(long depth) const noexcept
+    {
+        const long ticks = depth - _mid_depth; //ticks worse than the hashing mid price
+        const Key offset = static_cast<Key>(ticks < 0 ? -ticks : ticks) * tick_size;
+        if constexpr (side == BookSide::ASK)
+            return ticks < 0 ? _hashing_mid_price - offset : _hashing_mid_price + offset;
+        else
+            return ticks < 0 ? _hashing_mid_price + offset : _hashing_mid_price - offset;
+    }
+    
+    //price of level 'index' in a fast book or collision block, which is dense level 'slot'
+    template<class Block>
+    constexpr key_reference _block_key(const Block& block, size_t index, size_t slot) const noexcept
+    {
+        if constexpr (_keyless)
+            return _key_at_depth(_slot_depth(slot));
+        else
+            return block.key(index);
+    }
+    
+    template<class Block>
+    bool _erase_in_block(const Key& key, Block& block, size_t index, size_t slot)
+    {
+        if(!_occupied.test(slot)) //a sentinel level zeroed through find_ptr is still in the book
+            return false;
+        if(key != _block_key(block, index, slot))
+            throw std::runtime_error("key mismatch");
+        block.reset(index);
+        --_size;
+        return true;
+    }
+    
+    void _update_best(const Key& key)
+    {
+        if(!_best.has_value() || _is_better(key, _best.value()))
+            _best = key;
+    }
+    
+    //price and value of an occupied fast book or collision slot
+    key_reference _dense_key(size_t slot) const noexcept
+    {
+        const size_t hash = _positiveMod(static_cast<long>(slot)), collision_bucket = static_cast<size_t>(_floor_div(static_cast<long>(slot)));
+        if(collision_bucket == 0)
+            return _block_key(_fast_book, hash, slot);
+        return _block_key(_collision_block(hash), _collision_slot(hash, collision_bucket - 1), slot);
+    }
+    
+    Value& _dense_value(size_t slot) noexcept
+    {
+        const size_t hash = _positiveMod(static_cast<long>(slot)), collision_bucket = static_cast<size_t>(_floor_div(static_cast<long>(slot)));
+        if(collision_bucket == 0)
+            return _fast_book.value(hash);
+        return _collision_block(hash).value(_collision_slot(hash, collision_bucket - 1));
+    }
+    
+    const Value& _dense_value(size_t slot) const noexcept
+    {
+        const size_t hash = _positiveMod(static_cast<long>(slot)), collision_bucket = static_cast<size_t>(_floor_div(static_cast<long>(slot)));
+        if(collision_bucket == 0)
+            return _fast_book.value(hash);
+        return _collision_block(hash).value(_collision_slot(hash, collision_bucket - 1));
+    }
+    
+    void _reset_dense(size_t slot) noexcept
+    {
+        const size_t hash = _positiveMod(static_cast<long>(slot)), collision_bucket = static_cast<size_t>(_floor_div(static_cast<long>(slot)));
+        if(collision_bucket == 0)
+        {
+            _fast_book.reset(hash);
+            _occupied.reset(slot);
+        }
+        else
+        {
+            _collision_block(hash).reset(_collision_slot(hash, collision_bucket - 1));
+            _occupied.reset(slot);
+            _release_collision_block(hash);
+        }
+    }
+    
+    //first occupied fast book or collision slot at or deeper than 'depth', _dense_levels if there are none.
+    //with a ring offset each tier holds its depths in buckets offset..N-1 then 0..offset-1, so two runs of slots per tier
+    size_t _next_dense_slot(size_t depth) const noexcept
+    {
+        if(_ring_offset == 0) //slots are in depth order
+            return _occupied.find_next(depth);
+        
+        size_t tier = static_cast<size_t>(_floor_div(static_cast<long>(depth)));
+        size_t hash = _positiveMod(static_cast<long>(depth + _ring_offset));
+        for(; tier <= collision_buckets; ++tier, hash = _ring_offset)
+        {
+            const size_t first = tier * fast_book_size;
+            if(hash >= _ring_offset)
+            {
+                const size_t slot = _occupied.find_next(first + hash);
+                if(slot < first + fast_book_size)
+                    return slot;
+                hash = 0;
+            }
+            const size_t slot = _occupied.find_next(first + hash);
+            if(slot < first + _ring_offset)
+                return slot;
+        }
+        return _dense_levels;
+    }
+    
+    //last occupied fast book or collision slot at or shallower than 'depth', _dense_levels if there are none.
+    //the same two runs of slots per tier as _next_dense_slot, searched backwards
+    size_t _prev_dense_slot(size_t depth) const noexcept
+    {
+        if(_ring_offset == 0) //slots are in depth order
+            return _occupied.find_prev(depth);
+        
+        long tier = _floor_div(static_cast<long>(depth));
+        size_t hash = _positiveMod(static_cast<long>(depth + _ring_offset));
+        for(; tier >= 0; --tier, hash = _ring_offset - 1)
+        {
+            const size_t first = static_cast<size_t>(tier) * fast_book_size;
+            if(hash < _ring_offset)
+            {
+                const size_t slot = _occupied.find_prev(first + hash);
+                if(slot < _dense_levels && slot >= first)
+                    return slot;
+                hash = fast_book_size - 1;
+            }
+            const size_t slot = _occupied.find_prev(first + hash);
+            if(slot < _dense_levels && slot >= first + _ring_offset)
+                return slot;
+        }
+        return _dense_levels;
+    }
+    
+    //the overflow node of a price in the overflow index
+    const collision_node* _overflow_node(const Key& key) const noexcept
+    {
+        return _buckets[_positiveMod(_depth(key) + static_cast<long>(_ring_offset))].overflow_bucket.find(_overflow_index(key));
+    }
+    
+    //best price in the overflow buckets
+    std::optional<Key> _best_overflow_key() const noexcept
+    {
+        if(_overflow_keys.empty())
+            return std::nullopt;
+        return _overflow_keys.front();
+    }
+    
+    //the best price was erased. crossed prices beat everything, then the dense tiers (a bit scan), then the overflow
+    void _recover_best() noexcept
+    {
+        if(_size == 0)
+            _best.reset();
+        else if(_crossed_size > 0)
+            _best = _best_overflow_key();
+        else if(const size_t slot = _next_dense_slot(0); slot < _dense_levels)
+            _best = _dense_key(slot);
+        else
+            _best = _best_overflow_key();
+    }
+    
+    //calculates the hash based on the depth from the top of the fast book and the size of the array
+    constexpr bool _hash_key(const Key& key, size_t& hash, size_t& collision_bucket, const Key& hashing_mid_price) const
+    {
+        const long depth = _mid_depth + _ticks_worse(key, hashing_mid_price); //can be -ve
+        hash = _positiveMod(depth + static_cast<long>(_ring_offset)); //must always be +ve
+        //if the price is better than the top of the fast book, e.g. a crossed book, we use the overflow buckets
+        //to store these as the nodes are reserved for worse prices. a select rather than a branch
+        collision_bucket = depth < 0 ? collision_buckets + 1 : static_cast<size_t>(_floor_div(depth));
+        return depth >= 0 && collision_bucket < collision_buckets;
+    }
+    
+    bool _insert(Key&& key, Value&& value)
+    {
+        if constexpr (Layout::sentinel_empty_levels)
+        {
+            if(value == Value{}) //the empty level sentinel, e.g. a quantity of 0, can't be stored
+                return false;
+        }
+        
+        return _place(std::move(key), std::move(value));
+    }
+    
+    //hashes and inserts a level without the sentinel check. for levels moving within the book, where a level zeroed
+    //through find_ptr is still a level and has to keep its Value{}
+    bool _place(Key&& key, Value&& value)
+    {
+        size_t hash, collision_bucket; //collision bucket of 0 means we are looking in the fast book. Should give us better cache performance
+        hash_key(key, hash, collision_bucket);
+        return _insert_at(std::move(key), std::move(value), hash, collision_bucket);
+    }
+    
+    //room for one more element without the push reallocating, grown geometrically
+    template<class Vector>
+    static void _reserve_one(Vector& vector)
+    {
+        if(vector.size() == vector.capacity())
+            vector.reserve(std::max<size_t>(2 * vector.capacity(), 8));
+    }
+    
+    //insert once the key has been hashed
+    bool _insert_at(Key&& key, Value&& value, size_t hash, size_t collision_bucket)
+    {
+        auto& bucket = _buckets[hash];
+        
+        if constexpr (_keyless)
+        {
+            //the price isn't stored, so it has to be the one the level's depth gives back.
+            //checked for overflow levels too as they can move into the fast book or collision buckets
+            if(_key_at_depth(_depth(key)) != key)
+                throw std::runtime_error("key not on the tick grid");
+        }
+        
+        if(collision_bucket == 0) //we're looking in the fast book
+        {
+            if(_occupied.test(hash))
+                return false;
+            
+            _update_best(key);
+            _occupied.set(hash);
+            _fast_book.emplace(hash, std::move(key), std::move(value));
+        }
+        else if(collision_bucket -1 < collision_buckets)//were looknig in nodes.
+        {
+            if(_occupied.test(collision_bucket * fast_book_size + hash)) //we already have a value! so is error
+                return false;
+            
+            auto& nodes = _insert_collision_block(hash);
+            const size_t collision_slot = _collision_slot(hash, collision_bucket - 1);
+            _update_best(key);
+            _occupied.set(collision_bucket * fast_book_size + hash);
+            nodes.emplace(collision_slot, std::move(key), std::move(value));
+        }
+        else//if we are using overflow buckets? i.e. collison bucket is larger than the hardcoded allowed
+        {
+            const long overflow_index = _overflow_index(key);
+            if(bucket.overflow_bucket.find(overflow_index)) //it might be in overflow buckets
+                return false;
+            
+            _overflow_keys.reserve_one(); //so indexing can't fail once the level is in
+            const size_t position = _overflow_key_position(key);
+            const Key indexed = key;
+            _update_best(key);
+            if(overflow_index < 0)
+                ++_crossed_size;
+            bucket.overflow_bucket.insert(std::move(key), std::move(value), overflow_index);
+            _overflow_keys.insert(position, indexed);
+        }
+        ++_size;
+        return true;
+    }
+    
+    //finds or makes the level for key, hashing it once, and hands its value to fn. fn returns false to remove the level,
+    //e.g. when its quantity reaches zero. a new level starts as Value{} and is only added if fn keeps it.
+    //returns true if the level is in the book afterwards
+    template<class Fn>
+    bool _upsert(Key&& key, Fn&& fn)
+    {
+        size_t hash, collision_bucket;
+        hash_key(key, hash, collision_bucket);
+        
+        //an empty level sentinel can't stay in the book, whatever fn says
+        auto keep = [&](Value& value)
+        {
+            const bool kept = fn(value);
+            if constexpr (Layout::sentinel_empty_levels)
+                return kept && value != Value{};
+            else
+                return kept;
+        };
+        
+        if(collision_bucket <= collision_buckets) //fast book or collision levels
+        {
+            const size_t slot = collision_bucket * fast_book_size + hash;
+            if(_occupied.test(slot))
+            {
+                if(key != _dense_key(slot))
+                    throw std::runtime_error("key mismatch");
+                if(keep(_dense_value(slot)))
+                    return true;
+                _reset_dense(slot);
+                --_size;
+                if(_best.has_value() && _best.value() == key)
+                    _recover_best();
+                return false;
+            }
+        }
+        else if(collision_node* node = _find_node(key, _buckets[hash].overflow_bucket))
+        {
+            if(keep(node->level.second))
+                return true;
+            _erase_overflow(_buckets[hash].overflow_bucket, node);
+            if(_best.has_value() && _best.value() == key)
+                _recover_best();
+            return false;
+        }
+        
+        Value value{};
+        if(!keep(value))
+            return false;
+        return _insert_at(std::move(key), std::move(value), hash, collision_bucket);
+    }
+    
+    //fills in the handle of a level in the book
+    void _fill_handle(level_handle& handle, const Key& key, size_t hash, size_t collision_bucket) const
+    {
+        handle._key = key;
+        handle._hash = hash;
+        handle._collision_bucket = collision_bucket;
+        handle._generation = _generation;
+        handle._bucket_generation = _bucket_generations[hash];
+        if(collision_bucket > collision_buckets)
+        {
+            const auto& overflow_bucket = _buckets[hash].overflow_bucket;
+            handle._collision_index = _overflow_index(key);
+            handle._position = static_cast<size_t>(overflow_bucket.lower_bound(handle._collision_index) - overflow_bucket.nodes.begin());
+        }
+    }
+    
+    //false once anything has moved the handle's level, or could have
+    bool _handle_current(const level_handle& handle) const noexcept
+    {
+        return handle._generation == _generation && handle._bucket_generation == _bucket_generations[handle._hash];
+    }
+    
+    //true if dense 'slot' still holds the handle's price. off grid prices can share a slot with another price once
+    //the handle's level has gone, so the stored key has to match too. keyless tiers derive the key from the slot
+    bool _handle_holds(const level_handle& handle, size_t slot) const noexcept
+    {
+        if(!_occupied.test(slot))
+            return false;
+        if constexpr (_keyless)
+            return true;
+        else
+            return _dense_key(slot) == handle._key;
+    }
+    
+    //the overflow node of a current handle. inserts and erases in the bucket can shift it, then it's searched for.
+    //like _handle_holds the key has to match, an off grid price can take the collision index of an erased level
+    const collision_node* _handle_node(const level_handle& handle) const noexcept
+    {
+        const auto& overflow_bucket = _buckets[handle._hash].overflow_bucket;
+        const collision_node* node = nullptr;
+        if(handle._position < overflow_bucket.nodes.size() && overflow_bucket.nodes[handle._position].collision_index == handle._collision_index)
+            node = &overflow_bucket.nodes[handle._position];
+        else
+            node = overflow_bucket.find(handle._collision_index);
+        return node != nullptr && node->level.first == handle._key ? node : nullptr;
+    }
+    
+    //moves the window of prices, and the hashing mid price with it, one tick worse or better. every depth changes by one
+    //but only one bucket crosses a tier boundary: the one at the top of the window going worse, or the one just before
+    //it going better. only its levels move, each one tier up or down in the same bucket.
+    //where they land is worked out first and the storage they need is taken before anything changes: a collision block
+    //(the spare, or a new one) when a level moves into a bucket without one, and room in the overflow for a level leaving
+    //the dense tiers. if that allocation throws the side is untouched, and after it the moves can't fail
+    void _step_window(bool worse)
+    {
+        const size_t hash = worse ? _ring_offset : _positiveMod(static_cast<long>(_ring_offset) - 1);
+        const long shift = worse ? -1 : 1; //change in the tier, or collision index, of the bucket's levels
+        auto& bucket = _buckets[hash];
+        auto& overflow_bucket = bucket.overflow_bucket;
+        
+        bool needs_block = false, needs_overflow = false;
+        for(size_t collision_bucket = 0; collision_bucket <= collision_buckets; ++collision_bucket)
+        {
+            if(!_occupied.test(collision_bucket * fast_book_size + hash))
+                continue;
+            const long tier = static_cast<long>(collision_bucket) + shift;
+            needs_block |= tier > 0 && tier <= _last_tier;
+            needs_overflow |= tier < 0 || tier > _last_tier;
+        }
+        const long entering = worse ? _last_tier + 1 : -1; //collision index of the overflow level that becomes dense
+        const bool overflow_enters = overflow_bucket.find(entering) != nullptr;
+        needs_block |= overflow_enters && entering + shift > 0;
+        
+        if constexpr (!_inline_collisions)
+        {
+            //an emptied block goes to the spare, or is freed if there already is one, and comes back from it
+            if(needs_block && !bucket.nodes && !_spare_block)
+                _spare_block.reset(_allocate_unique<level_block<collision_buckets>>(_allocator).release());
+        }
+        if(needs_overflow && !overflow_enters) //one level out of the overflow and one in needs no more room
+        {
+            _reserve_one(overflow_bucket.nodes);
+            _overflow_keys.reserve_one();
+        }
+        
+        //take out the bucket's fast book and collision levels, plus the one overflow level that becomes dense
+        std::array<std::optional<std::pair<Key, Value>>, collision_buckets + 2> moving;
+        size_t moving_count = 0;
+        for(size_t collision_bucket = 0; collision_bucket <= collision_buckets; ++collision_bucket)
+        {
+            const size_t slot = collision_bucket * fast_book_size + hash;
+            if(!_occupied.test(slot))
+                continue;
+            moving[moving_count++].emplace(Key(_dense_key(slot)), std::move(_dense_value(slot)));
+            _reset_dense(slot);
+            --_size;
+        }
+        
+        for(auto& node : overflow_bucket)
+            node.collision_index += shift; //still sorted
+        if(auto* node = overflow_bucket.find(entering + shift))
+        {
+            moving[moving_count++].emplace(node->level.first, std::move(node->level.second));
+            _erase_overflow(overflow_bucket, node);
+        }
+        
+        _ring_offset = worse ? _positiveMod(static_cast<long>(_ring_offset) + 1) : hash;
+        //every other bucket's levels keep their slots, and overflow positions, so only this bucket's handles go stale
+        if(moving_count > 0 || !overflow_bucket.nodes.empty())
+            ++_bucket_generations[hash];
+        if((side == BookSide::ASK) == worse)
+            _hashing_mid_price = _hashing_mid_price + tick_size;
+        else
+            _hashing_mid_price = _hashing_mid_price - tick_size;
+        
+        //each level lands in its own slot, with the storage already there
+        for(size_t i = 0; i < moving_count; ++i)
+            _place(std::move(moving[i]->first), std::move(moving[i]->second));
+    }
+    
+    //reinserts every level into a new side around hashing_mid_price and takes its storage
+    void _rebuild(const Key& hashing_mid_price)
+    {
+        auto rehashed = _allocate_unique<HashOrderBookSide>(_allocator, hashing_mid_price, _allocator); //not on the stack, an inline collision tier can be big
+        
+        //extract each fast book and collision level and insert into the rehashed side
+        for(size_t slot = _occupied.find_first(); slot < _dense_levels; slot = _occupied.find_next(slot + 1))
+        {
+            Key key = _dense_key(slot);
+            if(!rehashed->_place(std::move(key), std::move(_dense_value(slot))))
+                throw std::runtime_error("Failed to insert into new buckets");
+        }
+        
+        for(auto& bucket : _buckets)
+        {
+            //overflow buckets
+            for(auto& node: bucket.overflow_bucket)
+            {
+                if(!rehashed->_place(std::move(node.level.first), std::move(node.level.second)))
+                    throw std::runtime_error("Failed to insert into new buckets");
+            }
+        }
+        
+        //no copy assignment or move on std::array. move each individually
+        _fast_book = std::move(rehashed->_fast_book);
+        _collision_book = std::move(rehashed->_collision_book);
+        for(size_t i = 0; i < _buckets.size(); ++i)
+        {
+            if constexpr (!_inline_collisions)
+                _buckets[i].nodes.reset(rehashed->_buckets[i].nodes.release()); //same allocator, so only the pointer moves
+            _buckets[i].overflow_bucket = std::move(rehashed->_buckets[i].overflow_bucket);
+        }
+        _hashing_mid_price = hashing_mid_price;
+        _ring_offset = rehashed->_ring_offset;
+        _size = rehashed->_size;
+        _swap_by_construction(_overflow_keys, rehashed->_overflow_keys);
+        _crossed_size = rehashed->_crossed_size;
+        _occupied = rehashed->_occupied;
+        ++_generation;
+    }
+
+public:
+    using value_type = std::pair<Key, Value>;
+    
+    //true when hashing is all shifts and masks, i.e. fast_book_size and an integral tick_size are powers of two.
+    //static_assert on it to keep a latency sensitive book on the fast path
+    static constexpr bool fast_hashing = _power_of_two_book && _power_of_two_tick();
+    
+    HashOrderBookSide(const Key& hashing_mid_price, const Allocator& allocator = Allocator())
+    : _allocator(allocator)
+    , _spare_block(collision_bucket_type::_empty_block_ptr(allocator))
+    , _overflow_keys(allocator)
+    , _hashing_mid_price(hashing_mid_price)
+    {
+        //std::array can't hand its elements a constructor argument. the buckets start empty and are rebuilt
+        //with the book's allocator, which then owns the collision blocks and overflow buckets
+        for(auto& bucket : _buckets)
+        {
+            std::destroy_at(&bucket);
+            try
+            {
+                std::construct_at(&bucket, _allocator);
+            }
+            catch(...)
+            {
+                std::construct_at(&bucket); //leave something for the destructor
+                throw;
+            }
+        }
+    }
+    ~HashOrderBookSide() = default;
+    HashOrderBookSide(const HashOrderBookSide&) = delete;
+    
+    //collision blocks and overflow buckets are handed over, not copied. the moved from side is left empty
+    HashOrderBookSide(HashOrderBookSide&& other) noexcept
+    : HashOrderBookSide(other._hashing_mid_price, other._allocator)
+    {
+        swap(other);
+    }
+    
+    //swaps, so this side's old levels are freed with the moved from side
+    HashOrderBookSide& operator=(HashOrderBookSide&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+    
+    //swaps the levels, heap storage and allocators. the fast book, collision buckets and bitmap are copied across,
+    //the collision blocks and overflow buckets only by pointer. iterators stay with the side object, not the levels
+    void swap(HashOrderBookSide& other) noexcept
+    {
+        if(this == &other)
+            return;
+        std::swap(_fast_book, other._fast_book);
+        if constexpr (_inline_collisions)
+            std::swap(_collision_book, other._collision_book);
+        for(size_t i = 0; i < fast_book_size; ++i)
+            _swap_by_construction(_buckets[i], other._buckets[i]);
+        _swap_by_construction(_allocator, other._allocator);
+        _swap_by_construction(_spare_block, other._spare_block);
+        _swap_by_construction(_overflow_keys, other._overflow_keys);
+        std::swap(_hashing_mid_price, other._hashing_mid_price);
+        std::swap(_ring_offset, other._ring_offset);
+        std::swap(_size, other._size);
+        std::swap(_crossed_size, other._crossed_size);
+        std::swap(_best, other._best);
+        std::swap(_occupied, other._occupied);
+        std::swap(_bucket_generations, other._bucket_generations);
+        //neither side's handles mean anything now, on either side
+        _generation = other._generation = std::max(_generation, other._generation) + 1;
+    }
+    
+    friend void swap(HashOrderBookSide& a, HashOrderBookSide& b) noexcept
+    {
+        a.swap(b);
+    }
+    
+    allocator_type get_allocator() const noexcept
+    {
+        return _allocator;
+    }
+    
+    //moves the prices to their depths around a new hashing mid price. a move of less than the fast book is done in place
+    //as window steps, which only touch the levels changing tier and reuse the existing storage.
+    //bigger moves, or a hashing mid price off the tick grid of the current one, rebuild the side.
+    //either way every level_handle goes stale
+    void rehash(const Key& hashing_mid_price)
+    {
+        const long ticks = ticks_from_hashing_mid(hashing_mid_price);
+        if(std::labs(ticks) < static_cast<long>(fast_book_size) && _key_at_depth(_mid_depth + ticks) == hashing_mid_price)
+        {
+            recentre(hashing_mid_price, fast_book_size);
+            ++_generation;
+            return;
+        }
+        _rebuild(hashing_mid_price);
+    }
+    
+    //calculates the hash based on the depth from the top of the fast book and the size of the array
+    constexpr bool hash_key(const Key& key, size_t& hash, size_t& collision_bucket) const
+    {
+        return _hash_key(key, hash, collision_bucket, _hashing_mid_price);
+    }
+    
+    //best price on this side
+    constexpr const std::optional<Key>& best() const noexcept
+    {
+        return _best;
+    }
+    
+    constexpr const Key& hashing_mid_price() const noexcept
+    {
+        return _hashing_mid_price;
+    }
+    
+    //signed ticks from the hashing mid price to 'price', +ve in this side's worse direction
+    constexpr long ticks_from_hashing_mid(const Key& price) const noexcept
+    {
+        return _ticks_worse(price, _hashing_mid_price);
+    }
+    
+    //moves the hashing mid price towards 'target' by at most max_steps ticks, one window step at a time so each step only
+    //moves the levels of one bucket. the side is consistent between steps, so a big move can be spread over calls.
+    //returns true once the hashing mid price is within a tick of target. only the level_handles into the buckets it moved go stale
+    bool recentre(const Key& target, size_t max_steps)
+    {
+        for(long ticks = ticks_from_hashing_mid(target); ticks != 0; ticks = ticks_from_hashing_mid(target))
+        {
+            if(max_steps-- == 0)
+                return false;
+            _step_window(ticks > 0);
+        }
+        return true;
+    }
+    
+    bool insert(Key&& key, Value&& value)
+    {
+        return _insert(std::move(key), std::move(value));
+    }
+    
+    //the stored value of the level, nullptr if it isn't in the book. nothing is copied, so this is the
+    //lookup to use for big values. the pointer is good until the level is erased or the side rehashes,
+    //and setting a sentinel layout's value to Value{} through it has the same rule as the iterators
+    const Value* find_ptr(const Key& key) const
+    {
+        size_t hash, collision_bucket;
+        hash_key(key, hash, collision_bucket);
+        
+        if(collision_bucket <= collision_buckets) //fast book or collision levels, the bitmap says if it's there
+        {
+            const size_t slot = collision_bucket * fast_book_size + hash;
+            if(!_occupied.test(slot))
+                return nullptr;
+            if(key != _dense_key(slot))
+                throw std::runtime_error("key mismatch");
+            return &_dense_value(slot);
+        }
+        
+        //if we are using overflow buckets? i.e. collison bucket is larget than the hardcoded allowed
+        const collision_node* node = _find_node(key, _buckets[hash].overflow_bucket);
+        return node ? &node->level.second : nullptr;
+    }
+    
+    Value* find_ptr(const Key& key)
+    {
+        return const_cast<Value*>(std::as_const(*this).find_ptr(key));
+    }
+    
+    bool find(const Key& key, Value& value) const
+    {
+        const Value* found = find_ptr(key);
+        if(!found)
+            return false;
+        value = *found;
+        return true;
+    }
+    
+    //value of the best level, nullptr on an empty side
+    const Value* best_ptr() const
+    {
+        return _best.has_value() ? find_ptr(_best.value()) : nullptr;
+    }
+    
+    Value* best_ptr()
+    {
+        return _best.has_value() ? find_ptr(_best.value()) : nullptr;
+    }
+    
+    //inserts the level or overwrites its value. true if the level is new
+    bool insert_or_assign(Key&& key, Value&& value)
+    {
+        const size_t levels = _size;
+        _upsert(std::move(key), [&](Value& level)
+        {
+            level = std::move(value);
+            return true;
+        });
+        return _size > levels;
+    }
+    
+    //calls fn(Value&) on the level, value initialised if it's new, locating it once.
+    //fn returns false to remove the level. returns true if the level is in the book afterwards
+    template<class Fn>
+    bool update(const Key& key, Fn&& fn)
+    {
+        return _upsert(Key(key), std::forward<Fn>(fn));
+    }
+    
+    //adds delta to the level's quantity, adding the level if needed and erasing it when it gets to zero (Value{}).
+    //returns true if the level is in the book afterwards
+    template<class Delta>
+    bool add_quantity(const Key& key, const Delta& delta)
+    {
+        return _upsert(Key(key), [&](Value& level)
+        {
+            level += delta;
+            return level != Value{};
+        });
+    }
+    
+    bool erase(const Key& key)
+    {
+        size_t hash, collision_bucket;
+        hash_key(key, hash, collision_bucket);
+        auto& bucket = _buckets[hash];
+        
+        if(collision_bucket == 0) //we're looking in the fast book
+        {
+            if(!_erase_in_block(key, _fast_book, hash, hash))
+                return false;
+            _occupied.reset(hash);
+        }
+        else if(collision_bucket -1 < collision_buckets)//were looknig in nodes.
+        {
+            const size_t slot = collision_bucket * fast_book_size + hash;
+            if(!_occupied.test(slot)) //before the block, a bucket with no collision levels may not have one
+                return false;
+            if(!_erase_in_block(key, _collision_block(hash), _collision_slot(hash, collision_bucket - 1), slot))
+                return false;
+            _occupied.reset(slot);
+            _release_collision_block(hash);
+        }
+        else if(!_erase_node(key, bucket.overflow_bucket)) //if we are using overflow buckets? i.e. collison bucket is larget than the hardcoded allowed
+            return false;
+        
+        if(_best.has_value() && _best.value() == key)
+            _recover_best();
+        return true;
+    }
+    
+    //handles. made by find_handle or insert, stale after a rehash, swap or clear with a new mid price, or a recentre
+    //that moves their bucket's levels.
+    //a stale handle finds nothing, so find_handle again when a handle call fails
+    bool find_handle(const Key& key, level_handle& handle) const
+    {
+        size_t hash, collision_bucket;
+        hash_key(key, hash, collision_bucket);
+        if(collision_bucket <= collision_buckets)
+        {
+            const size_t slot = collision_bucket * fast_book_size + hash;
+            if(!_occupied.test(slot))
+                return false;
+            if(key != _dense_key(slot))
+                throw std::runtime_error("key mismatch");
+        }
+        else if(!_find_node(key, _buckets[hash].overflow_bucket))
+            return false;
+        _fill_handle(handle, key, hash, collision_bucket);
+        return true;
+    }
+    
+    bool insert(Key&& key, Value&& value, level_handle& handle)
+    {
+        if constexpr (Layout::sentinel_empty_levels)
+        {
+            if(value == Value{})
+                return false;
+        }
+        
+        size_t hash, collision_bucket;
+        hash_key(key, hash, collision_bucket);
+        const Key handle_key = key;
+        if(!_insert_at(std::move(key), std::move(value), hash, collision_bucket))
+            return false;
+        _fill_handle(handle, handle_key, hash, collision_bucket);
+        return true;
+    }
+    
+    //true while the handle's level is in the book
+    bool valid(const level_handle& handle) const noexcept
+    {
+        return find_ptr(handle) != nullptr;
+    }
+    
+    const Value* find_ptr(const level_handle& handle) const noexcept
+    {
+        if(!_handle_current(handle))
+            return nullptr;
+        if(handle._collision_bucket <= collision_buckets)
+        {
+            const size_t slot = handle._collision_bucket * fast_book_size + handle._hash;
+            return _handle_holds(handle, slot) ? &_dense_value(slot) : nullptr;
+        }
+        const collision_node* node = _handle_node(handle);
+        return node ? &node->level.second : nullptr;
+    }
+    
+    Value* find_ptr(const level_handle& handle) noexcept
+    {
+        return const_cast<Value*>(std::as_const(*this).find_ptr(handle));
+    }
+    
+    //sets the level's value. false if the handle is stale or its level has gone. a sentinel layout's empty value
+    //erases the level, as it can't be stored, so like update(key, fn) it returns whether the level is still there
+    bool update(const level_handle& handle, Value&& value)
+    {
+        Value* level = find_ptr(handle);
+        if(!level)
+            return false;
+        if constexpr (Layout::sentinel_empty_levels)
+        {
+            if(value == Value{})
+                return !erase(handle);
+        }
+        *level = std::move(value);
+        return true;
+    }
+    
+    bool erase(const level_handle& handle)
+    {
+        if(!_handle_current(handle))
+            return false;
+        bool was_best = false; //whether the price actually taken out was the best
+        if(handle._collision_bucket <= collision_buckets)
+        {
+            const size_t slot = handle._collision_bucket * fast_book_size + handle._hash;
+            if(!_handle_holds(handle, slot))
+                return false;
+            was_best = _best.has_value() && _best.value() == _dense_key(slot);
+            _reset_dense(slot);
+            --_size;
+        }
+        else
+        {
+            const collision_node* node = _handle_node(handle);
+            if(!node)
+                return false;
+            was_best = _best.has_value() && _best.value() == node->level.first;
+            _erase_overflow(_buckets[handle._hash].overflow_bucket, node);
+        }
+        if(was_best)
+            _recover_best();
+        return true;
+    }
+    
+    constexpr size_t size() const noexcept
+    {
+        return _size;
+    }
+    
+    //live storage. collision blocks only count while allocated, overflow buckets and the overflow index by their capacity
+    size_t getByteSize() const
+    {
+        size_t size = sizeof(_fast_book) + _overflow_keys.bytes();
+        if constexpr (_inline_collisions)
+            size += sizeof(_collision_book);
+        for(auto& bucket : _buckets)
+        {
+            size += sizeof(bucket.overflow_bucket);
+            size += bucket.overflow_bucket.nodes.capacity() * sizeof(collision_node);
+            if constexpr (!_inline_collisions)
+            {
+                size += sizeof(bucket.nodes);
+                if(bucket.nodes)
+                    size += sizeof(*bucket.nodes);
+            }
+        }
+        if constexpr (!_inline_collisions)
+        {
+            if(_spare_block)
+                size += sizeof(*_spare_block);
+        }
+        return size;
+    }
+    
+    //adds the page number of every page of 'page_size' the side's storage touches, the side itself included
+    void collect_pages(std::vector<std::uintptr_t>& pages, size_t page_size) const
+    {
+        auto add = [&](const void* p, size_t bytes)
+        {
+            if(p == nullptr || bytes == 0)
+                return;
+            const auto first = reinterpret_cast<std::uintptr_t>(p) / page_size;
+            const auto last = (reinterpret_cast<std::uintptr_t>(p) + bytes - 1) / page_size;
+            for(auto page = first; page <= last; ++page)
+                pages.push_back(page);
+        };
+        add(this, sizeof(*this));
+        add(_overflow_keys.keys.data(), _overflow_keys.keys.capacity() * sizeof(Key));
+        add(_overflow_keys.firsts.data(), _overflow_keys.firsts.capacity() * sizeof(size_t));
+        for(auto& bucket : _buckets)
+        {
+            add(bucket.overflow_bucket.nodes.data(), bucket.overflow_bucket.nodes.capacity() * sizeof(collision_node));
+            if constexpr (!_inline_collisions)
+                add(bucket.nodes.get(), sizeof(level_block<collision_buckets>));
+        }
+        if constexpr (!_inline_collisions)
+            add(_spare_block.get(), sizeof(level_block<collision_buckets>));
+    }
+    
+    //distinct pages the side's storage sits on, i.e. the TLB entries needed to touch all of it
+    size_t getPageCount(size_t page_size) const
+    {
+        std::vector<std::uintptr_t> pages;
+        collect_pages(pages, page_size);
+        std::sort(pages.begin(), pages.end());
+        return static_cast<size_t>(std::unique(pages.begin(), pages.end()) - pages.begin());
+    }
+    
+    //gives back the spare collision block and any overflow capacity beyond what the levels need
+    void shrink_to_fit()
+    {
+        if constexpr (!_inline_collisions)
+            _spare_block.reset();
+        for(auto& bucket : _buckets)
+            bucket.overflow_bucket.shrink_to_fit();
+        _overflow_keys.shrink_to_fit();
+    }
+    
+    void clear()
+    {
+        _fast_book.clear();
+        if constexpr (_inline_collisions)
+            _collision_book.clear();
+        for(auto& bucket : _buckets)
+        {
+            if constexpr (!_inline_collisions)
+            {
+                if(bucket.nodes && !_spare_block)
+                {
+                    bucket.nodes->clear();
+                    _spare_block.reset(bucket.nodes.release());
+                }
+                bucket.nodes.reset();
+            }
+            bucket.overflow_bucket.clear();
+        }
+        _overflow_keys.clear();
+        _size = 0;
+        _crossed_size = 0;
+        _best.reset();
+        _occupied.clear();
+    }
+    
+    void clear(const Key& new_mid_price)
+    {
+        clear();
+        _hashing_mid_price = new_mid_price;
+        _ring_offset = 0;
+        ++_generation;
+    }
+    
+    //fn(price, value) for each level from best to worse, at most max_depth levels. fn can return false to stop early.
+    //no iterator, it runs straight over the storage tier by tier: the crossed levels, a bit scan of the fast book and
+    //each collision tier, then the rest of the overflow index. returns the number of levels visited
+    template<class Fn>
+    size_t for_each_level(Fn&& fn, size_t max_depth = std::numeric_limits<size_t>::max()) const
+    {
+        size_t visited = 0;
+        auto visit = [&](key_reference key, const Value& value)
+        {
+            if(visited == max_depth)
+                return false;
+            ++visited;
+            if constexpr (std::is_void_v<std::invoke_result_t<Fn&, key_reference, const Value&>>)
+            {
+                fn(key, value);
+                return true;
+            }
+            else
+                return static_cast<bool>(fn(key, value));
+        };
+        auto visit_overflow = [&](size_t from, size_t to)
+        {
+            for(size_t position = from; position < to; ++position)
+            {
+                const Key& key = _overflow_keys[position];
+                if(!visit(key, _overflow_node(key)->level.second))
+                    return false;
+            }
+            return true;
+        };
+        
+        if(!visit_overflow(0, _crossed_size))
+            return visited;
+        
+        //each tier holds its depths in buckets ring offset..N-1 then 0..ring offset-1
+        auto visit_fast = [&](size_t slot)
+        {
+            return visit(_block_key(_fast_book, slot, slot), _fast_book.value(slot));
+        };
+        if(!_occupied.for_each(_ring_offset, fast_book_size, visit_fast) || !_occupied.for_each(0, _ring_offset, visit_fast))
+            return visited;
+        for(size_t tier = 1; tier <= collision_buckets; ++tier)
+        {
+            const size_t first = tier * fast_book_size;
+            auto visit_collision = [&](size_t slot)
+            {
+                const size_t hash = slot - first;
+                const auto& block = _collision_block(hash);
+                const size_t index = _collision_slot(hash, tier - 1);
+                return visit(_block_key(block, index, slot), block.value(index));
+            };
+            if(!_occupied.for_each(first + _ring_offset, first + fast_book_size, visit_collision) || !_occupied.for_each(first, first + _ring_offset, visit_collision))
+                return visited;
+        }
+        
+        visit_overflow(_crossed_size, _overflow_keys.size());
+        return visited;
+    }
+    
+    //copies the best levels into the caller's arrays, as many as both hold. no allocation and no iterator.
+    //returns the number of levels copied
+    size_t snapshot(std::span<Key> keys, std::span<Value> values) const
+    {
+        size_t level = 0;
+        return for_each_level([&](key_reference key, const Value& value)
+        {
+            keys[level] = key;
+            values[level++] = value;
+        }, std::min(keys.size(), values.size()));
+    }
+    
+    friend void RunTests();
+
+private:
+    
+    //iterators hand out a (price, value) pair of references into the book
+    template<class Reference>
+    struct arrow_proxy
+    {
+        Reference reference;
+        constexpr Reference* operator->() noexcept { return &reference; }
+    };
+    
+    enum class IteratorDirection { FORWARD, REVERSE};
+    enum class IteratorConstness { CONST, NON_CONST};
+    
+    //walks the side from best to worse price, i.e. in increasing depth, or from worst to best in reverse.
+    //bidirectional, each step is a bit scan in the dense tiers or one place along the overflow index.
+    //a CONST iterator holds a const side and hands out const values, so it can walk a const book
+    template<IteratorDirection direction = IteratorDirection::FORWARD, IteratorConstness constness = IteratorConstness::NON_CONST>
+    class Xiterator
+    {
+    private:
+        static constexpr bool _is_const = constness == IteratorConstness::CONST;
+        using book_pointer = std::conditional_t<_is_const, const HashOrderBookSide*, HashOrderBookSide*>;
+        using node_pointer = std::conditional_t<_is_const, const collision_node*, collision_node*>;
+        using value_type_reference = std::conditional_t<_is_const, std::pair<key_reference, const Value&>, std::pair<key_reference, Value&>>;
+        using value_type_pointer = arrow_proxy<value_type_reference>;
+        
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type_reference; //a pair of references, by value
+        using pointer = value_type_pointer;
+        
+    private:
+        size_t _index = 0;
+        long _collision_bucket = 0; //-ve for crossed levels
+        size_t _overflow_position = 0; //of an overflow level in the side's overflow index. a hint, checked before it's used
+        book_pointer _book = nullptr;
+        bool _isEnd = true;
+        
+        //an end. it keeps the side only to step back from the end
+        explicit Xiterator(book_pointer book)
+        : _book(book)
+        {
+        }
+        
+    public:
+        Xiterator()  = default;
+        // Default copy constructor - used for same type
+        Xiterator(const Xiterator& other) noexcept = default;
+        
+        Xiterator(Xiterator&& other) noexcept
+        {
+            _index = std::move(other._index);
+            _collision_bucket = std::move(other._collision_bucket);
+            _overflow_position = std::move(other._overflow_position);
+            _book = std::move(other._book);
+            _isEnd = std::move(other._isEnd);
+        }
+        
+        // Default copy assignment operator - used for same type
+        Xiterator& operator=(const Xiterator& other) noexcept = default;
+        
+        //an iterator converts to a const one, not the other way
+        template<IteratorConstness other_constness>
+        requires (_is_const && other_constness == IteratorConstness::NON_CONST)
+        Xiterator(const Xiterator<direction, other_constness>& other) noexcept
+        : _index(other._index),
+          _collision_bucket(other._collision_bucket),
+          _overflow_position(other._overflow_position),
+          _book(other._book),
+          _isEnd(other._isEnd)
+        {
+        }
+        
+        //the same level walked the other way
+        auto get_other_direction() const noexcept
+        {
+            constexpr IteratorDirection other = direction == IteratorDirection::FORWARD ? IteratorDirection::REVERSE : IteratorDirection::FORWARD;
+            Xiterator<other, constness> it(_book);
+            it._index = _index;
+            it._collision_bucket = _collision_bucket;
+            it._overflow_position = _overflow_position;
+            it._isEnd = _isEnd;
+            return it;
+        }
+    
+    private:
+        
+        constexpr void _set_depth(long depth) noexcept
+        {
+            _index = _positiveMod(depth + static_cast<long>(_book->_ring_offset));
+            _collision_bucket = _floor_div(depth);
+        }
+        
+        constexpr void _set_slot(size_t slot) noexcept
+        {
+            _index = _positiveMod(static_cast<long>(slot));
+            _collision_bucket = _floor_div(static_cast<long>(slot));
+        }
+        
+        //to the overflow level at 'position' in the overflow index, or the end
+        void _to_overflow(size_t position)
+        {
+            if(position >= _book->_overflow_keys.size())
+            {
+                _isEnd = true;
+                return;
+            }
+            _isEnd = false;
+            _overflow_position = position;
+            _set_depth(_book->_depth(_book->_overflow_keys[position]));
+        }
+        
+        //a best overflow level is the front of the overflow index, crossed or not
+        void _to_best()
+        {
+            if(!_book->_best.has_value())
+            {
+                _isEnd = true;
+                return;
+            }
+            _isEnd = false;
+            _overflow_position = 0;
+            _set_depth(_book->_depth(_book->_best.value()));
+        }
+        
+        //the deepest overflow level, else the deepest dense one, else the last crossed one
+        void _to_worst()
+        {
+            const auto& keys = _book->_overflow_keys;
+            if(keys.size() == _book->_crossed_size)
+            {
+                if(const size_t slot = _book->_prev_dense_slot(_dense_levels - 1); slot < _dense_levels)
+                {
+                    _isEnd = false;
+                    _set_slot(slot);
+                    return;
+                }
+            }
+            _to_overflow(keys.empty() ? 0 : keys.size() - 1);
+        }
+        
+        //levels in the overflow index better than this overflow level, i.e. its position while it's in the book.
+        //one check when the hint is right, a binary search when levels were added or erased since the last step
+        size_t _overflow_levels_better() const
+        {
+            const auto& keys = _book->_overflow_keys;
+            const long depth = _book->_depth_of(_index, _collision_bucket);
+            if(_overflow_position < keys.size() && _book->_depth(keys[_overflow_position]) == depth)
+                return _overflow_position;
+            return keys.partition_point([&](const Key& key)
+            {
+                return _book->_depth(key) < depth;
+            });
+        }
+        
+        //position in the overflow index of the next level worse than this overflow level
+        size_t _next_overflow_position() const
+        {
+            const size_t position = _overflow_levels_better();
+            const auto& keys = _book->_overflow_keys;
+            if(position < keys.size() && _book->_depth(keys[position]) == _book->_depth_of(_index, _collision_bucket))
+                return position + 1;
+            return position; //this level has gone, the next one is where it was
+        }
+        
+        //one level worse, or the end. a bit scan through the fast book and collision levels, one step along the
+        //overflow index past them
+        void _step_worse()
+        {
+            if(_collision_bucket >= 0 && _collision_bucket <= _last_tier)
+            {
+                //jump straight to the next occupied fast book or collision level
+                const size_t slot = _book->_next_dense_slot(static_cast<size_t>(_book->_depth_of(_index, _collision_bucket)) + 1);
+                if(slot < _dense_levels)
+                    return _set_slot(slot);
+                //nothing left in the dense tiers, on to the overflow levels past them. the crossed ones come first in the index
+                return _to_overflow(_book->_crossed_size);
+            }
+            
+            const size_t next = _next_overflow_position();
+            if(_collision_bucket < 0 && next >= _book->_crossed_size) //walked out of the crossed levels into the fast book
+            {
+                if(const size_t slot = _book->_next_dense_slot(0); slot < _dense_levels)
+                    return _set_slot(slot);
+            }
+            _to_overflow(next);
+        }
+        
+        //one level better, or the end. the same walk backwards
+        void _step_better()
+        {
+            if(_collision_bucket >= 0 && _collision_bucket <= _last_tier)
+            {
+                if(const long depth = _book->_depth_of(_index, _collision_bucket); depth > 0)
+                {
+                    if(const size_t slot = _book->_prev_dense_slot(static_cast<size_t>(depth - 1)); slot < _dense_levels)
+                        return _set_slot(slot);
+                }
+                //nothing better in the dense tiers, back to the last crossed level
+                if(_book->_crossed_size == 0)
+                {
+                    _isEnd = true;
+                    return;
+                }
+                return _to_overflow(_book->_crossed_size - 1);
+            }
+            
+            const size_t better = _overflow_levels_better();
+            if(_collision_bucket > _last_tier && better <= _book->_crossed_size) //walked back out of the overflow into the dense tiers
+            {
+                if(const size_t slot = _book->_prev_dense_slot(_dense_levels - 1); slot < _dense_levels)
+                    return _set_slot(slot);
+            }
+            if(better == 0)
+            {
+                _isEnd = true;
+                return;
+            }
+            _to_overflow(better - 1);
+        }
+        
+        const collision_node* _find_overflow_node() const
+        {
+            return _book->_buckets[_index].overflow_bucket.find(_collision_bucket);
+        }
+        
+        value_type_reference _get_value_type() const
+        {
+            if(_collision_bucket == 0)
+            {
+                auto& block = _book->_fast_book;
+                return value_type_reference(_book->_block_key(block, _index, _index), block.value(_index));
+            }
+            else if(_collision_bucket > 0 && _collision_bucket <= _last_tier)
+            {
+                auto& block = _book->_collision_block(_index);
+                const size_t slot = _collision_slot(_index, _collision_bucket - 1);
+                return value_type_reference(_book->_block_key(block, slot, _collision_bucket * fast_book_size + _index), block.value(slot));
+            }
+            else //is overflow bucket
+            {
+                auto* node = const_cast<node_pointer>(_find_overflow_node());
+                return value_type_reference(node->level.first, node->level.second);
+            }
+        }
+    public:
+        Xiterator& operator++()
+        {
+            if(_book == nullptr || _isEnd) [[unlikely]]
+            {
+                return *this;
+            }
+            
+            if constexpr (direction == IteratorDirection::FORWARD)
+                _step_worse();
+            else
+                _step_better();
+            return *this;
+        }
+        //back from the end gives the last level in the direction of travel
+        Xiterator& operator--()
+        {
+            if(_book == nullptr) [[unlikely]]
+            {
+                return *this;
+            }
+            
+            if constexpr (direction == IteratorDirection::FORWARD)
+            {
+                if(_isEnd)
+                    _to_worst();
+                else
+                    _step_better();
+            }
+            else
+            {
+                if(_isEnd)
+                    _to_best();
+                else
+                    _step_worse();
+            }
+            return *this;
+        }
+        //post-increment
+        Xiterator operator++(int)
+        {
+            Xiterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+        //post-decrement
+        Xiterator operator--(int)
+        {
+            Xiterator tmp = *this;
+            --(*this);
+            return tmp;
+        }
+        constexpr value_type_pointer operator->() const
+        {
+            return value_type_pointer{_get_value_type()};
+        }
+        constexpr value_type_reference operator*() const
+        {
+            return _get_value_type();
+        }
+        constexpr bool operator==(const Xiterator& rhs) const
+        {
+            //ends compare equal whichever book they came from
+            if(_isEnd || rhs._isEnd)
+                return _isEnd == rhs._isEnd;
+            return _book == rhs._book && _index == rhs._index && _collision_bucket == rhs._collision_bucket;
+        }
+        constexpr bool operator!=(const Xiterator& rhs) const
+        {
+            return !(*this == rhs);
+        }
+        friend class HashOrderBookSide;
+        template<IteratorDirection, IteratorConstness>
+        friend class Xiterator;
+    };
+public:
+    using iterator = Xiterator<>;
+    using const_iterator = Xiterator<IteratorDirection::FORWARD, IteratorConstness::CONST>;
+    using reverse_iterator = Xiterator<IteratorDirection::REVERSE>;
+    using const_reverse_iterator = Xiterator<IteratorDirection::REVERSE, IteratorConstness::CONST>;
+    
+    //ends compare equal whichever side they came from, so one kept from before a move or swap still works
+    iterator end() noexcept
+    {
+        return iterator(this);
+    }
+    
+    const_iterator end() const noexcept
+    {
+        return const_iterator(this);
+    }
+    
+    iterator begin()
+    {
+        iterator it(this);
+        it._to_best();
+        return it;
+    }
+    
+    const_iterator begin() const
+    {
+        const_iterator it(this);
+        it._to_best();
+        return it;
+    }
+    
+    //worst price to best
+    reverse_iterator rbegin()
+    {
+        reverse_iterator it(this);
+        it._to_worst();
+        return it;
+    }
+    
+    const_reverse_iterator rbegin() const
+    {
+        const_reverse_iterator it(this);
+        it._to_worst();
+        return it;
+    }
+    
+    reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(this);
+    }
+    
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(this);
+    }
+    
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+    
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+    
+    const_reverse_iterator crbegin() const
+    {
+        return rbegin();
+    }
+    
+    const_reverse_iterator crend() const noexcept
+    {
+        return rend();
+    }
+};
+
+
+//two sided book built from a bid side and an ask side. each side owns its own levels
+//so a one sided walk never touches the other side's memory, and each side can be used on its own.
+template<KeyConcept Key,
+        class Value,
+        Key tick_size, //small key value to show minimum price movement
+        size_t fast_book_size, //fast book size is size of bid and ask depth combined
+        size_t collision_buckets,
+        bool auto_rehash = false, //recentre a few levels per insert / erase once the mid price drifts too far from the hashing mid price
+        class Layout = interleaved_layout, //how levels are laid out in the fast book and collision buckets
+        class Allocator = std::allocator<std::byte>> //for collision blocks and overflow buckets, e.g. std::pmr::polymorphic_allocator
+class HashOrderBook
+{
+public:
+    
+    using Side = BookSide;
+    
+    static constexpr Key tick_size_val = tick_size;
+    static constexpr size_t fast_book_size_val = fast_book_size;
+    static constexpr size_t collision_buckets_val = collision_buckets;
+    static constexpr size_t cache_line_size = 128;
+    
+    using layout_type = Layout;
+    using allocator_type = Allocator;
+    using bid_book_type = HashOrderBookSide<Key, Value, tick_size, fast_book_size, collision_buckets, Side::BID, Layout, Allocator>;
+    using ask_book_type = HashOrderBookSide<Key, Value, tick_size, fast_book_size, collision_buckets, Side::ASK, Layout, Allocator>;
+    using bid_level_handle = typename bid_book_type::level_handle;
+    using ask_level_handle = typename ask_book_type::level_handle;
+    template<Side side>
+    using level_handle = std::conditional_t<side == Side::BID, bid_level_handle, ask_level_handle>;
+    
+    //e.g. static_assert(BookType::fast_hashing, "book must hash with shifts and masks");
+    static constexpr bool fast_hashing = bid_book_type::fast_hashing;
+
+private:
+    //each side on its own cache lines so they can live in different cores' caches without false sharing
+    alignas(cache_line_size) bid_book_type _bids;
+    alignas(cache_line_size) ask_book_type _asks;
+    
+    //auto rehash. recentring starts when the mid is more than threshold * fast_book_size ticks from the hashing mid price
+    //and moves at most steps_per_operation ticks per insert / erase until both sides are centred on the target
+    double _rehash_threshold = 0.25;
+    size_t _rehash_steps = 4;
+    std::optional<Key> _rehash_target;
+    
+    void _auto_rehash()
+    {
+        if(!_rehash_target.has_value())
+        {
+            const Key mid = getMid();
+            const long drift = std::max(std::labs(_bids.ticks_from_hashing_mid(mid)), std::labs(_asks.ticks_from_hashing_mid(mid)));
+            if(static_cast<double>(drift) <= _rehash_threshold * fast_book_size)
+                return;
+            _rehash_target = mid;
+        }
+        
+        //bids and asks step independently so one side finishing early doesn't stall the other
+        const bool bids_centred = _bids.recentre(_rehash_target.value(), _rehash_steps);
+        const bool asks_centred = _asks.recentre(_rehash_target.value(), _rehash_steps);
+        if(bids_centred && asks_centred)
+            _rehash_target.reset();
+    }
+
+public:
+    using value_type = std::pair<Key, Value>;
+    
+    HashOrderBook(const Key& hashing_mid_price, const Allocator& allocator = Allocator())
+    : _bids(hashing_mid_price, allocator)
+    , _asks(hashing_mid_price, allocator)
+    {
+    }
+    ~HashOrderBook() = default;
+    HashOrderBook(const HashOrderBook&) = delete;
+    //moves hand the heap storage over, so books can live in a std::vector or be built off to the side and swapped in
+    HashOrderBook(HashOrderBook&&) noexcept = default;
+    HashOrderBook& operator=(HashOrderBook&&) noexcept = default;
+    
+    void swap(HashOrderBook& other) noexcept
+    {
+        _bids.swap(other._bids);
+        _asks.swap(other._asks);
+        std::swap(_rehash_threshold, other._rehash_threshold);
+        std::swap(_rehash_steps, other._rehash_steps);
+        std::swap(_rehash_target, other._rehash_target);
+    }
+    
+    friend void swap(HashOrderBook& a, HashOrderBook& b) noexcept
+    {
+        a.swap(b);
+    }
+    
+    bid_book_type& bids() noexcept { return _bids; }
+    const bid_book_type& bids() const noexcept { return _bids; }
+    ask_book_type& asks() noexcept { return _asks; }
+    const ask_book_type& asks() const noexcept { return _asks; }
+    
+    void rehash(const Key& hashing_mid_price)
+    {
+        _bids.rehash(hashing_mid_price);
+        _asks.rehash(hashing_mid_price);
+        _rehash_target.reset();
+    }
+    
+    //auto rehash tuning. threshold is the fraction of the fast book the mid can drift before recentring starts,
+    //steps_per_operation bounds the ticks each side moves per insert / erase, which bounds the levels moved
+    void set_auto_rehash(double threshold, size_t steps_per_operation) noexcept
+    {
+        _rehash_threshold = threshold;
+        _rehash_steps = std::max<size_t>(steps_per_operation, 1);
+    }
+    
+    //true while an auto rehash is part way through recentring
+    constexpr bool rehash_pending() const noexcept
+    {
+        return _rehash_target.has_value();
+    }
+    
+    //calculates the hash based on an offset from the mid and the size of the array.
+    //buckets are reported in price order, lowest price first, for both sides.
+    constexpr bool hash_key(Side side, const Key& key, size_t& hash, size_t& collision_bucket) const
+    {
+        if(side == Side::ASK)
+            return _asks.hash_key(key, hash, collision_bucket);
+        
+        const bool ok = _bids.hash_key(key, hash, collision_bucket);
+        hash = fast_book_size - 1 - hash; //bids are stored in their own (descending price) order
+        return ok;
+    }
+    
+    bool getBestBid(Key& key, Value& value) const
+    {
+        const Value* best = _bids.best_ptr();
+        if(!best)
+            return false;
+        key = _bids.best().value();
+        value = *best;
+        return true;
+    }
+    
+    bool getBestOffer(Key& key, Value& value) const
+    {
+        const Value* best = _asks.best_ptr();
+        if(!best)
+            return false;
+        key = _asks.best().value();
+        value = *best;
+        return true;
+    }
+    
+    //the best levels' values without copying them, nullptr on an empty side
+    const Value* best_bid_ptr() const
+    {
+        return _bids.best_ptr();
+    }
+    
+    const Value* best_offer_ptr() const
+    {
+        return _asks.best_ptr();
+    }
+    
+    //mid of the best bid and offer, or whichever side has a best price, or the hashing mid price of an empty book
+    constexpr Key getMid() const noexcept
+    {
+        const auto& best_bid = _bids.best();
+        const auto& best_offer = _asks.best();
+        if(best_bid.has_value() && best_offer.has_value())
+            return (best_bid.value() + best_offer.value()) / 2;
+        else if(best_bid.has_value())
+            return best_bid.value();
+        else if(best_offer.has_value())
+            return best_offer.value();
+        return _asks.hashing_mid_price();
+    }
+    
+    //the side picked at compile time, e.g. book.side_book<Side::BID>().best()
+    template<Side side>
+    constexpr auto& side_book() noexcept
+    {
+        if constexpr (side == Side::BID)
+            return _bids;
+        else
+            return _asks;
+    }
+    
+    template<Side side>
+    constexpr const auto& side_book() const noexcept
+    {
+        if constexpr (side == Side::BID)
+            return _bids;
+        else
+            return _asks;
+    }
+    
+    //compile time side versions. a feed handler which knows the side gets code for that side only,
+    //e.g. book.insert<Side::BID>(std::move(price), std::move(quantity))
+    template<Side side>
+    bool insert(Key&& key, Value&& value)
+    {
+        const bool inserted = side_book<side>().insert(std::move(key), std::move(value));
+        if constexpr (auto_rehash)
+        {
+            if(inserted)
+                _auto_rehash();
+        }
+        return inserted;
+    }
+    
+    template<Side side>
+    bool find(const Key& key, Value& value) const
+    {
+        return side_book<side>().find(key, value);
+    }
+    
+    //zero copy lookups, see HashOrderBookSide::find_ptr
+    template<Side side>
+    Value* find_ptr(const Key& key)
+    {
+        return side_book<side>().find_ptr(key);
+    }
+    
+    template<Side side>
+    const Value* find_ptr(const Key& key) const
+    {
+        return side_book<side>().find_ptr(key);
+    }
+    
+    template<Side side>
+    bool erase(const Key& key)
+    {
+        const bool erased = side_book<side>().erase(key);
+        if constexpr (auto_rehash)
+        {
+            if(erased)
+                _auto_rehash();
+        }
+        return erased;
+    }
+    
+    //one hash per call. see HashOrderBookSide::insert_or_assign, update and add_quantity
+    template<Side side>
+    bool insert_or_assign(Key&& key, Value&& value)
+    {
+        const bool inserted = side_book<side>().insert_or_assign(std::move(key), std::move(value));
+        if constexpr (auto_rehash)
+        {
+            if(inserted)
+                _auto_rehash();
+        }
+        return inserted;
+    }
+    
+    template<Side side, class Fn>
+    bool update(const Key& key, Fn&& fn)
+    {
+        const size_t levels = size();
+        const bool kept = side_book<side>().update(key, std::forward<Fn>(fn));
+        if constexpr (auto_rehash)
+        {
+            if(size() != levels)
+                _auto_rehash();
+        }
+        return kept;
+    }
+    
+    template<Side side, class Delta>
+    bool add_quantity(const Key& key, const Delta& delta)
+    {
+        const size_t levels = size();
+        const bool kept = side_book<side>().add_quantity(key, delta);
+        if constexpr (auto_rehash)
+        {
+            if(size() != levels)
+                _auto_rehash();
+        }
+        return kept;
+    }
+    
+    //level handles, for repeated calls at one price with no hashing. see HashOrderBookSide::level_handle.
+    //an auto rehash recentres, so it only makes the handles into the buckets it moves stale. find_handle again when a
+    //handle call fails. insert hands back a handle that is current after its own auto rehash
+    template<Side side>
+    bool find_handle(const Key& key, level_handle<side>& handle) const
+    {
+        return side_book<side>().find_handle(key, handle);
+    }
+    
+    template<Side side>
+    bool insert(Key&& key, Value&& value, level_handle<side>& handle)
+    {
+        const bool inserted = side_book<side>().insert(std::move(key), std::move(value), handle);
+        if constexpr (auto_rehash)
+        {
+            if(inserted)
+            {
+                _auto_rehash();
+                if(const Key handle_key = handle.key(); !side_book<side>().valid(handle)) //the level moved
+                    side_book<side>().find_handle(handle_key, handle);
+            }
+        }
+        return inserted;
+    }
+    
+    template<Side side>
+    bool update(const level_handle<side>& handle, Value&& value)
+    {
+        const size_t levels = size();
+        const bool kept = side_book<side>().update(handle, std::move(value));
+        if constexpr (auto_rehash)
+        {
+            if(size() != levels)
+                _auto_rehash();
+        }
+        return kept;
+    }
+    
+    template<Side side>
+    bool erase(const level_handle<side>& handle)
+    {
+        const bool erased = side_book<side>().erase(handle);
+        if constexpr (auto_rehash)
+        {
+            if(erased)
+                _auto_rehash();
+        }
+        return erased;
+    }
+    
+    //the handle's type says which side it's for
+    bool update(const bid_level_handle& handle, Value&& value)
+    {
+        return update<Side::BID>(handle, std::move(value));
+    }
+    
+    bool update(const ask_level_handle& handle, Value&& value)
+    {
+        return update<Side::ASK>(handle, std::move(value));
+    }
+    
+    bool erase(const bid_level_handle& handle)
+    {
+        return erase<Side::BID>(handle);
+    }
+    
+    bool erase(const ask_level_handle& handle)
+    {
+        return erase<Side::ASK>(handle);
+    }
+    
+    Value* find_ptr(const bid_level_handle& handle) noexcept
+    {
+        return _bids.find_ptr(handle);
+    }
+    
+    const Value* find_ptr(const bid_level_handle& handle) const noexcept
+    {
+        return _bids.find_ptr(handle);
+    }
+    
+    Value* find_ptr(const ask_level_handle& handle) noexcept
+    {
+        return _asks.find_ptr(handle);
+    }
+    
+    const Value* find_ptr(const ask_level_handle& handle) const noexcept
+    {
+        return _asks.find_ptr(handle);
+    }
+    
+    //runtime side versions, one branch then the compile time version
+    bool insert(Side side, Key&& key, Value&& value)
+    {
+        return side == Side::BID ? insert<Side::BID>(std::move(key), std::move(value))
+                                 : insert<Side::ASK>(std::move(key), std::move(value));
+    }
+    
+    bool find(Side side, const Key& key, Value& value) const
+    {
+        return side == Side::BID ? find<Side::BID>(key, value) : find<Side::ASK>(key, value);
+    }
+    
+    Value* find_ptr(Side side, const Key& key)
+    {
+        return side == Side::BID ? find_ptr<Side::BID>(key) : find_ptr<Side::ASK>(key);
+    }
+    
+    const Value* find_ptr(Side side, const Key& key) const
+    {
+        return side == Side::BID ? find_ptr<Side::BID>(key) : find_ptr<Side::ASK>(key);
+    }
+    
+    bool erase(Side side, const Key& key)
+    {
+        return side == Side::BID ? erase<Side::BID>(key) : erase<Side::ASK>(key);
+    }
+    
+    bool insert_or_assign(Side side, Key&& key, Value&& value)
+    {
+        return side == Side::BID ? insert_or_assign<Side::BID>(std::move(key), std::move(value))
+                                 : insert_or_assign<Side::ASK>(std::move(key), std::move(value));
+    }
+    
+    template<class Fn>
+    bool update(Side side, const Key& key, Fn&& fn)
+    {
+        return side == Side::BID ? update<Side::BID>(key, std::forward<Fn>(fn)) : update<Side::ASK>(key, std::forward<Fn>(fn));
+    }
+    
+    template<class Delta>
+    bool add_quantity(Side side, const Key& key, const Delta& delta)
+    {
+        return side == Side::BID ? add_quantity<Side::BID>(key, delta) : add_quantity<Side::ASK>(key, delta);
+    }
+    
+    constexpr size_t size() const noexcept
+    {
+        return _bids.size() + _asks.size();
+    }
+    
+    size_t getByteSize() const
+    {
+        return _bids.getByteSize() + _asks.getByteSize();
+    }
+    
+    void shrink_to_fit()
+    {
+        _bids.shrink_to_fit();
+        _asks.shrink_to_fit();
+    }
+    
+    //distinct pages of 'page_size' both sides' storage sits on, i.e. the book's TLB footprint
+    size_t getPageCount(size_t page_size) const
+    {
+        std::vector<std::uintptr_t> pages;
+        _bids.collect_pages(pages, page_size);
+        _asks.collect_pages(pages, page_size);
+        std::sort(pages.begin(), pages.end());
+        return static_cast<size_t>(std::unique(pages.begin(), pages.end()) - pages.begin());
+    }
+    
+    void clear()
+    {
+        _bids.clear();
+        _asks.clear();
+        _rehash_target.reset();
+    }
+    
+    void clear(const Key& new_mid_price)
+    {
+        _bids.clear(new_mid_price);
+        _asks.clear(new_mid_price);
+        _rehash_target.reset();
+    }
+    
+    friend void RunTests();
+
+public:
+    using ask_itertator = typename ask_book_type::iterator;
+    using const_ask_itertator = typename ask_book_type::const_iterator;
+    using bid_itertator = typename bid_book_type::iterator;
+    using const_bid_itertator = typename bid_book_type::const_iterator;
+    using ask_reverse_itertator = typename ask_book_type::reverse_iterator;
+    using const_ask_reverse_itertator = typename ask_book_type::const_reverse_iterator;
+    using bid_reverse_itertator = typename bid_book_type::reverse_iterator;
+    using const_bid_reverse_itertator = typename bid_book_type::const_reverse_iterator;
+    
+    ask_itertator ask_end()
+    {
+        return _asks.end();
+    }
+    
+    const_ask_itertator ask_end() const
+    {
+        return _asks.end();
+    }
+    
+    bid_itertator bid_end()
+    {
+        return _bids.end();
+    }
+    
+    const_bid_itertator bid_end() const
+    {
+        return _bids.end();
+    }
+    
+    ask_itertator ask_begin()
+    {
+        return _asks.begin();
+    }
+    
+    const_ask_itertator ask_begin() const
+    {
+        return _asks.begin();
+    }
+    
+    bid_itertator bid_begin()
+    {
+        return _bids.begin();
+    }
+    
+    const_bid_itertator bid_begin() const
+    {
+        return _bids.begin();
+    }
+    
+    //fn(price, value) for each level from best to worse without an iterator, see HashOrderBookSide::for_each_level.
+    //e.g. book.for_each_bid_level([&](auto price, const auto& quantity) { total += quantity; return total < wanted; }, 20)
+    template<Side side, class Fn>
+    size_t for_each_level(Fn&& fn, size_t max_depth = std::numeric_limits<size_t>::max()) const
+    {
+        return side_book<side>().for_each_level(std::forward<Fn>(fn), max_depth);
+    }
+    
+    template<class Fn>
+    size_t for_each_bid_level(Fn&& fn, size_t max_depth = std::numeric_limits<size_t>::max()) const
+    {
+        return for_each_level<Side::BID>(std::forward<Fn>(fn), max_depth);
+    }
+    
+    template<class Fn>
+    size_t for_each_ask_level(Fn&& fn, size_t max_depth = std::numeric_limits<size_t>::max()) const
+    {
+        return for_each_level<Side::ASK>(std::forward<Fn>(fn), max_depth);
+    }
+    
+    //the top 'depth' levels of a side as packed price and value arrays, e.g. for a publisher. stops at the smaller of
+    //depth and the arrays' sizes. returns the number of levels copied
+    template<Side side>
+    size_t snapshot(size_t depth, std::span<Key> keys, std::span<Value> values) const
+    {
+        depth = std::min({depth, keys.size(), values.size()});
+        return side_book<side>().snapshot(keys.first(depth), values.first(depth));
+    }
+    
+    size_t snapshot(Side side, size_t depth, std::span<Key> keys, std::span<Value> values) const
+    {
+        return side == Side::BID ? snapshot<Side::BID>(depth, keys, values) : snapshot<Side::ASK>(depth, keys, values);
+    }
+    
+    //worst price to best
+    ask_reverse_itertator ask_rbegin()
+    {
+        return _asks.rbegin();
+    }
+    
+    const_ask_reverse_itertator ask_rbegin() const
+    {
+        return _asks.rbegin();
+    }
+    
+    ask_reverse_itertator ask_rend()
+    {
+        return _asks.rend();
+    }
+    
+    const_ask_reverse_itertator ask_rend() const
+    {
+        return _asks.rend();
+    }
+    
+    bid_reverse_itertator bid_rbegin()
+    {
+        return _bids.rbegin();
+    }
+    
+    const_bid_reverse_itertator bid_rbegin() const
+    {
+        return _bids.rbegin();
+    }
+    
+    bid_reverse_itertator bid_rend()
+    {
+        return _bids.rend();
+    }
+    
+    const_bid_reverse_itertator bid_rend() const
+    {
+        return _bids.rend();
     }
 };
 
@@ -11,6 +11,8 @@
 #include <fstream>
 #include <sstream>
 #include <tuple>
+#include <map>
+#include <random>
 
 #ifdef __APPLE__
 #include <sys/sysctl.h>
@@ -67,28 +69,17 @@ static void test_failure(bool condition, const char* message, int line)
 
 
 
-static void RunTests()
+template<class Layout>
+static void RunLayoutTests(const char* layout_name)
 {
     // tick sizse of 1, fast book of 10, 3 collision buckets, max 3 overflow buckets
     using price_type = size_t;
     const price_type tick_size = 1, mid_price = 110;
     const size_t fast_book_size = 10, collision_buckets = 2;
-    using BookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets>;
+    using BookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, false, Layout>;
     BookType order_book(mid_price);
-    std::cout << "What size are things?..." << std::endl;
-    std::cout << "size of bid_ask_node: " << sizeof(BookType::bid_ask_node) << std::endl;
-    std::cout << "size of collision_bucket: " << sizeof(BookType::collision_bucket<3>) << std::endl;
-    std::cout << "size of overflow_bucket_type: " << sizeof(BookType::collision_bucket_type) << std::endl;
-    std::cout << "size of bucket_type: " << sizeof(BookType::bucket_type) << std::endl;
-    std::cout << "Cache line size: " << getCacheLineSize() << std::endl;
-    std::cout << "Size of static order_book: " << sizeof(order_book) << " bytes. Or "
-                << sizeof(order_book) / (double)getCacheLineSize() << " cache lines." << std::endl;
-    std::cout << "Size of book array: " << sizeof(order_book._buckets) << std::endl;
-    std::cout << "Total order_book size: " << order_book.getByteSize() << " bytes. Or "
-                << order_book.getByteSize() / getCacheLineSize() << " cache lines " << std::endl;
-    std::cout << "Node size: " << sizeof(BookType::collision_bucket<collision_buckets>) << " padding: " << BookType::collision_bucket<collision_buckets>::padding_size << std::endl;
     
-    std::cout << std::endl << "Running tests..." << std::endl;
+    std::cout << std::endl << "Running tests with " << layout_name << " layout..." << std::endl;
     
     std::cout << "Testing hashing..." << std::endl;
     
@@ -499,7 +490,7 @@ static void RunTests()
     order_book.clear(110);
     std::cout << "Testing iterators..." << std::endl;
     //fill the book again
-     
+    
     //start with inserting some fast book keys
     for(price_type price = 105; price < 105 + fast_book_size; price+=2) //skip prices
     {
@@ -508,13 +499,897 @@ static void RunTests()
     }
     
     //test iterating over the book
-#ifdef CODE_WORKING
     std::cout << "Iterating over the book on the buy side" << std::endl;
+    price_type expected = 113, levels = 0;
     for(auto it = order_book.bid_begin(); it != order_book.bid_end(); ++it)
     {
-        std::cout << "Price: " << it->bid_value.value().first << " Volume: " << it->bid_value.value().second << std::endl;
+        std::cout << "Price: " << it->first << " Volume: " << it->second << std::endl;
+        test(it->first, expected, "bid iterator failed", __LINE__);
+        test(it->second, expected, "bid iterator failed", __LINE__);
+        expected -= 2;
+        ++levels;
     }
-#endif
+    test(levels, 5ul, "bid iterator failed", __LINE__);
+    
+    std::cout << "Iterating over the book on the sell side" << std::endl;
+    expected = 105;
+    levels = 0;
+    for(auto it = order_book.ask_begin(); it != order_book.ask_end(); ++it)
+    {
+        std::cout << "Price: " << (*it).first << " Volume: " << (*it).second << std::endl;
+        test((*it).first, expected, "ask iterator failed", __LINE__);
+        expected += 2;
+        ++levels;
+    }
+    test(levels, 5ul, "ask iterator failed", __LINE__);
+    
+    //one sided books can be used on their own
+    typename BookType::bid_book_type bid_book(mid_price);
+    test(bid_book.insert(100, 1), "one sided insert failed", __LINE__);
+    test(bid_book.insert(108, 2), "one sided insert failed", __LINE__);
+    test_failure(bid_book.insert(108, 2), "one sided insert failed", __LINE__);
+    test(bid_book.best().value(), 108ul, "one sided best failed", __LINE__);
+    test(bid_book.find(100, volume), "one sided find failed", __LINE__);
+    test(volume, 1ul, "one sided find failed", __LINE__);
+    test(bid_book.erase(100), "one sided erase failed", __LINE__);
+    test(bid_book.size(), 1ul, "one sided size failed", __LINE__);
+    
+    //overflow store. deep levels sharing a bucket come back in price order whatever order they went in
+    typename BookType::ask_book_type ask_book(mid_price);
+    for(price_type deep_price : {155ul, 135ul, 145ul})
+        test(ask_book.insert(std::move(deep_price), std::move(deep_price)), "overflow insert failed", __LINE__);
+    test_failure(ask_book.insert(145, 1), "overflow insert failed", __LINE__);
+    expected = 135;
+    for(auto it = ask_book.begin(); it != ask_book.end(); ++it, expected += 10)
+        test(it->first, expected, "overflow iterator failed", __LINE__);
+    test(expected, 165ul, "overflow iterator failed", __LINE__);
+    test(ask_book.erase(145), "overflow erase failed", __LINE__);
+    test_failure(ask_book.find(145, volume), "overflow erase failed", __LINE__);
+    test(ask_book.find(155, volume), "overflow find failed", __LINE__);
+    test(volume, 155ul, "overflow find failed", __LINE__);
+    const size_t overflow_bytes = ask_book.getByteSize();
+    ask_book.clear();
+    test(ask_book.getByteSize(), overflow_bytes, "overflow store should keep its capacity", __LINE__);
+    
+    //crossed prices get their own negative collision index so they don't clash in a bucket
+    test(ask_book.insert(100, 1), "crossed insert failed", __LINE__);
+    test(ask_book.insert(90, 2), "crossed insert failed", __LINE__);
+    test(ask_book.find(90, volume), "crossed find failed", __LINE__);
+    test(volume, 2ul, "crossed find failed", __LINE__);
+    test(ask_book.erase(100), "crossed erase failed", __LINE__);
+    test(ask_book.find(90, volume), "crossed find failed", __LINE__);
+    
+    //best price recovery when the top of the book is erased. fast book, collision tier, overflow and a crossed price
+    std::cout << "Testing best price after erase..." << std::endl;
+    order_book.clear(mid_price);
+    for(price_type bid : {111ul, 100ul, 85ul, 70ul, 120ul})
+        test(order_book.insert(BookType::Side::BID, std::move(bid), std::move(bid)), "insert failed", __LINE__);
+    price_type best_price = 0;
+    for(price_type next_best : {111ul, 100ul, 85ul, 70ul})
+    {
+        test(order_book.getBestBid(best_price, volume), "best bid failed", __LINE__);
+        test(order_book.erase(BookType::Side::BID, best_price), "erase failed", __LINE__);
+        test(order_book.getBestBid(best_price, volume), "best bid failed", __LINE__);
+        test(best_price, next_best, "best bid not recovered after erase", __LINE__);
+        test(order_book.bid_begin()->first, next_best, "bid begin not recovered after erase", __LINE__);
+    }
+    test(order_book.erase(BookType::Side::BID, 70), "erase failed", __LINE__);
+    test_failure(order_book.getBestBid(best_price, volume), "best bid should be empty", __LINE__);
+    test(order_book.bid_begin() == order_book.bid_end(), "bid begin should be end", __LINE__);
+    
+    //erasing a level which isn't the best leaves the best alone
+    test(order_book.insert(BookType::Side::ASK, 112, 1), "insert failed", __LINE__);
+    test(order_book.insert(BookType::Side::ASK, 114, 1), "insert failed", __LINE__);
+    test(order_book.erase(BookType::Side::ASK, 114), "erase failed", __LINE__);
+    test(order_book.getBestOffer(best_price, volume), "best offer failed", __LINE__);
+    test(best_price, 112ul, "best offer changed on erase", __LINE__);
+    
+    //recentring a tick at a time against a std::map. levels move between the fast book, collision tiers, overflow and crossed
+    std::cout << "Testing recentre..." << std::endl;
+    auto test_recentre = [](auto& side, auto better)
+    {
+        std::mt19937 rng(42);
+        std::map<price_type, price_type, decltype(better)> reference(better);
+        for(size_t op = 0; op < 4000; ++op)
+        {
+            const price_type level = 60 + rng() % 100;
+            if(rng() % 3 != 0)
+            {
+                const bool inserted = side.insert(price_type(level), price_type(level + 1));
+                test(inserted, reference.emplace(level, level + 1).second, "recentre insert failed", __LINE__);
+            }
+            else
+                test(side.erase(level), reference.erase(level) == 1, "recentre erase failed", __LINE__);
+            
+            if(op % 50 == 0)
+                side.recentre(60 + rng() % 100, 1 + rng() % 8); //sometimes part way there
+            
+            if(op % 10 != 0)
+                continue;
+            test(side.size(), reference.size(), "recentre size failed", __LINE__);
+            test(side.best().has_value(), !reference.empty(), "recentre best failed", __LINE__);
+            if(!reference.empty())
+                test(side.best().value(), reference.begin()->first, "recentre best failed", __LINE__);
+            auto expected = reference.begin();
+            for(auto it = side.begin(); it != side.end(); ++it, ++expected)
+            {
+                test(expected != reference.end(), "recentre iterator past end", __LINE__);
+                test(it->first, expected->first, "recentre iterator out of order", __LINE__);
+                test(it->second, expected->second, "recentre iterator value failed", __LINE__);
+            }
+            test(expected == reference.end(), "recentre iterator missed levels", __LINE__);
+            auto expected_reverse = reference.rbegin();
+            for(auto it = side.rbegin(); it != side.rend(); ++it, ++expected_reverse)
+            {
+                test(expected_reverse != reference.rend(), "reverse iterator past end", __LINE__);
+                test(it->first, expected_reverse->first, "reverse iterator out of order", __LINE__);
+            }
+            test(expected_reverse == reference.rend(), "reverse iterator missed levels", __LINE__);
+            //back from the end, then forward again from the best
+            auto back = side.end();
+            for(expected_reverse = reference.rbegin(); expected_reverse != reference.rend(); ++expected_reverse)
+                test((--back)->first, expected_reverse->first, "iterator decrement out of order", __LINE__);
+            if(!reference.empty())
+                test(back == side.begin(), "decrement should end at the best", __LINE__);
+            auto visited = reference.begin();
+            const size_t visits = side.for_each_level([&](const auto& level, const auto& level_volume)
+            {
+                test(visited != reference.end(), "for_each_level past end", __LINE__);
+                test(level, visited->first, "for_each_level out of order", __LINE__);
+                test(level_volume, visited->second, "for_each_level value failed", __LINE__);
+                ++visited;
+            });
+            test(visits, reference.size(), "for_each_level missed levels", __LINE__);
+        }
+        for(const auto& [level, level_volume] : reference)
+        {
+            price_type found = 0;
+            test(side.find(level, found), "recentre find failed", __LINE__);
+            test(found, level_volume, "recentre find failed", __LINE__);
+        }
+    };
+    typename BookType::bid_book_type recentre_bids(mid_price);
+    typename BookType::ask_book_type recentre_asks(mid_price);
+    test_recentre(recentre_bids, std::greater<price_type>());
+    test_recentre(recentre_asks, std::less<price_type>());
+    test(recentre_asks.recentre(150, 100), "recentre failed", __LINE__);
+    test(recentre_asks.hashing_mid_price(), 150ul, "recentre failed", __LINE__);
+    test_failure(recentre_asks.recentre(100, 10), "recentre should be part way", __LINE__);
+    test(recentre_asks.hashing_mid_price(), 140ul, "recentre step limit failed", __LINE__);
+    
+    //the iterator goes level to level through the overflow however far apart the levels are, crossed ones first
+    std::cout << "Testing overflow iteration..." << std::endl;
+    typename BookType::ask_book_type sparse_asks(mid_price);
+    std::vector<price_type> sparse_levels = {mid_price - 20, mid_price - 7}; //crossed
+    for(price_type level = mid_price + 2; level < mid_price + 5000; level += 37)
+        sparse_levels.push_back(level);
+    for(price_type level : sparse_levels)
+        test(sparse_asks.insert(price_type(level), price_type(level)), "overflow iteration insert failed", __LINE__);
+    auto sparse_expected = sparse_levels.begin();
+    for(auto it = sparse_asks.begin(); it != sparse_asks.end(); ++it, ++sparse_expected)
+    {
+        test(sparse_expected != sparse_levels.end(), "overflow iterator past end", __LINE__);
+        test(it->first, *sparse_expected, "overflow iterator out of order", __LINE__);
+    }
+    test(sparse_expected == sparse_levels.end(), "overflow iterator missed levels", __LINE__);
+    auto sparse_reverse_expected = sparse_levels.rbegin();
+    for(auto it = sparse_asks.rbegin(); it != sparse_asks.rend(); it++, ++sparse_reverse_expected)
+        test(it->first, *sparse_reverse_expected, "overflow reverse iterator out of order", __LINE__);
+    test(sparse_reverse_expected == sparse_levels.rend(), "overflow reverse iterator missed levels", __LINE__);
+    test((--sparse_asks.rend())->first, sparse_levels.front(), "reverse iterator decrement from the end failed", __LINE__);
+    test((*sparse_asks.rbegin().get_other_direction()).first, sparse_levels.back(), "get_other_direction failed", __LINE__);
+    //levels added and erased around an iterator in the overflow move its place in the overflow index
+    auto sparse_it = sparse_asks.begin();
+    while(sparse_it->first != mid_price + 2 + 37 * 20)
+        ++sparse_it;
+    test(sparse_asks.insert(price_type(mid_price + 2 + 37 * 19 + 1), price_type(1)), "overflow iteration insert failed", __LINE__);
+    test(sparse_asks.erase(mid_price - 20), "overflow iteration erase failed", __LINE__);
+    ++sparse_it;
+    test(sparse_it->first, mid_price + 2 + 37 * 21, "overflow iterator lost its place", __LINE__);
+    test(sparse_asks.erase(mid_price + 2 + 37 * 22), "overflow iteration erase failed", __LINE__);
+    ++sparse_it;
+    test(sparse_it->first, mid_price + 2 + 37 * 23, "overflow iterator lost its place", __LINE__);
+    //churn across several chunks of the overflow index against a std::map, shrinking it part way
+    std::mt19937 churn_rng(7);
+    std::map<price_type, price_type> churn_reference;
+    typename BookType::ask_book_type churn_asks(mid_price);
+    for(int operation = 0; operation < 12000; ++operation)
+    {
+        const price_type level = mid_price - 100 + churn_rng() % 2400; //crossed, dense and several chunks of overflow
+        if(churn_rng() % 3 != 0)
+            test(churn_asks.insert(price_type(level), price_type(level)), churn_reference.emplace(level, level).second, "overflow churn insert failed", __LINE__);
+        else
+            test(churn_asks.erase(level), churn_reference.erase(level) == 1, "overflow churn erase failed", __LINE__);
+        if(operation == 6000)
+            churn_asks.shrink_to_fit();
+    }
+    test(churn_asks.size(), churn_reference.size(), "overflow churn size failed", __LINE__);
+    test(churn_asks.best().value(), churn_reference.begin()->first, "overflow churn best failed", __LINE__);
+    auto churn_expected = churn_reference.begin();
+    for(auto it = churn_asks.begin(); it != churn_asks.end(); ++it, ++churn_expected)
+        test(it->first, churn_expected->first, "overflow churn iterator out of order", __LINE__);
+    test(churn_expected == churn_reference.end(), "overflow churn iterator missed levels", __LINE__);
+    auto churn_reverse_expected = churn_reference.rbegin();
+    for(auto it = churn_asks.rbegin(); it != churn_asks.rend(); ++it, ++churn_reverse_expected)
+        test(it->first, churn_reverse_expected->first, "overflow churn reverse iterator out of order", __LINE__);
+    
+    //compile time side
+    std::cout << "Testing compile time side..." << std::endl;
+    BookType static_side_book(mid_price);
+    test(static_side_book.template insert<BookType::Side::BID>(price_type(mid_price - 12), price_type(3)), "compile time insert failed", __LINE__);
+    test_failure(static_side_book.template insert<BookType::Side::BID>(price_type(mid_price - 12), price_type(3)), "compile time duplicate insert failed", __LINE__);
+    test(static_side_book.template insert<BookType::Side::ASK>(price_type(mid_price + 12), price_type(4)), "compile time insert failed", __LINE__);
+    price_type static_side_volume = 0;
+    test(static_side_book.find(BookType::Side::BID, mid_price - 12, static_side_volume), "compile time insert went to the wrong side", __LINE__);
+    test(static_side_volume, 3ul, "compile time insert failed", __LINE__);
+    test(static_side_book.template find<BookType::Side::ASK>(mid_price + 12, static_side_volume), "compile time find failed", __LINE__);
+    test(static_side_volume, 4ul, "compile time find failed", __LINE__);
+    test_failure(static_side_book.template find<BookType::Side::ASK>(mid_price - 12, static_side_volume), "compile time find went to the wrong side", __LINE__);
+    test(static_side_book.template side_book<BookType::Side::BID>().best().value(), mid_price - 12, "side_book failed", __LINE__);
+    test(static_side_book.template erase<BookType::Side::BID>(mid_price - 12), "compile time erase failed", __LINE__);
+    test(static_side_book.size(), 1ul, "compile time erase failed", __LINE__);
+    
+    //upserts. one lookup, the best price kept up to date, levels erased when their quantity gets to zero
+    std::cout << "Testing upserts..." << std::endl;
+    BookType upsert_book(mid_price);
+    price_type upsert_volume = 0, upsert_best = 0;
+    for(price_type level : {mid_price - 1, mid_price - 14, mid_price - 30, mid_price + 3}) //fast book, collision, overflow, crossed
+    {
+        test(upsert_book.insert_or_assign(BookType::Side::BID, price_type(level), price_type(5)), "insert_or_assign insert failed", __LINE__);
+        test_failure(upsert_book.insert_or_assign(BookType::Side::BID, price_type(level), price_type(7)), "insert_or_assign should assign", __LINE__);
+        test(upsert_book.find(BookType::Side::BID, level, upsert_volume), "insert_or_assign find failed", __LINE__);
+        test(upsert_volume, 7ul, "insert_or_assign assign failed", __LINE__);
+        test(upsert_book.add_quantity(BookType::Side::BID, level, 3ul), "add_quantity failed", __LINE__);
+        test(upsert_book.find(BookType::Side::BID, level, upsert_volume), "add_quantity find failed", __LINE__);
+        test(upsert_volume, 10ul, "add_quantity failed", __LINE__);
+        test(upsert_book.update(BookType::Side::BID, level, [](price_type& volume) { volume *= 2; return true; }), "update failed", __LINE__);
+        test(upsert_book.find(BookType::Side::BID, level, upsert_volume), "update find failed", __LINE__);
+        test(upsert_volume, 20ul, "update failed", __LINE__);
+    }
+    test(upsert_book.size(), 4ul, "upsert size failed", __LINE__);
+    test(upsert_book.getBestBid(upsert_best, upsert_volume), "upsert best failed", __LINE__);
+    test(upsert_best, mid_price + 3, "upsert best failed", __LINE__);
+    //taking the quantity to zero erases the level and recovers the best
+    test_failure(upsert_book.add_quantity(BookType::Side::BID, mid_price + 3, price_type(0) - 20), "add_quantity to zero should erase", __LINE__);
+    test(upsert_book.getBestBid(upsert_best, upsert_volume), "upsert best failed", __LINE__);
+    test(upsert_best, mid_price - 1, "upsert best not recovered", __LINE__);
+    test_failure(upsert_book.update(BookType::Side::BID, mid_price - 14, [](price_type&) { return false; }), "update should erase", __LINE__);
+    test_failure(upsert_book.add_quantity(BookType::Side::BID, mid_price - 30, price_type(0) - 20), "add_quantity to zero should erase", __LINE__);
+    test(upsert_book.size(), 1ul, "upsert erase failed", __LINE__);
+    //a new level added through add_quantity, and one that update declines to keep
+    test(upsert_book.template add_quantity<BookType::Side::ASK>(mid_price + 20, 4ul), "add_quantity new level failed", __LINE__);
+    test(upsert_book.find(BookType::Side::ASK, mid_price + 20, upsert_volume), "add_quantity new level failed", __LINE__);
+    test(upsert_volume, 4ul, "add_quantity new level failed", __LINE__);
+    test_failure(upsert_book.update(BookType::Side::ASK, mid_price + 21, [](price_type&) { return false; }), "update shouldn't add the level", __LINE__);
+    test(upsert_book.size(), 2ul, "upsert size failed", __LINE__);
+    
+    //zero copy lookups. pointers straight into the book, const books included
+    std::cout << "Testing find_ptr..." << std::endl;
+    BookType ptr_book(mid_price);
+    const BookType& const_ptr_book = ptr_book;
+    for(price_type level : {mid_price - 1, mid_price - 14, mid_price - 30, mid_price + 3}) //fast book, collision, overflow, crossed
+    {
+        test(const_ptr_book.find_ptr(BookType::Side::BID, level) == nullptr, "find_ptr of a missing level should be null", __LINE__);
+        test(ptr_book.insert(BookType::Side::BID, price_type(level), price_type(level)), "find_ptr insert failed", __LINE__);
+        const price_type* const_value = const_ptr_book.find_ptr(BookType::Side::BID, level);
+        test(const_value != nullptr, "const find_ptr failed", __LINE__);
+        test(*const_value, level, "const find_ptr failed", __LINE__);
+        price_type* value = ptr_book.template find_ptr<BookType::Side::BID>(level);
+        test(value == const_value, "find_ptr should point at the stored value", __LINE__);
+        *value += 1; //updated in place
+        test(const_ptr_book.find(BookType::Side::BID, level, upsert_volume), "const find failed", __LINE__);
+        test(upsert_volume, level + 1, "find_ptr update failed", __LINE__);
+        test(const_ptr_book.find_ptr(BookType::Side::ASK, level) == nullptr, "find_ptr went to the wrong side", __LINE__);
+    }
+    test(const_ptr_book.best_bid_ptr() == const_ptr_book.find_ptr(BookType::Side::BID, mid_price + 3), "best_bid_ptr failed", __LINE__);
+    test(const_ptr_book.best_offer_ptr() == nullptr, "best_offer_ptr of an empty side should be null", __LINE__);
+    test(const_ptr_book.getBestBid(upsert_best, upsert_volume), "const getBestBid failed", __LINE__);
+    test(upsert_volume, mid_price + 4, "const getBestBid failed", __LINE__);
+    test_failure(const_ptr_book.getBestOffer(upsert_best, upsert_volume), "const getBestOffer of an empty side failed", __LINE__);
+    
+    //const iterators walk a const book and hand out const values
+    std::cout << "Testing const iterators..." << std::endl;
+    static_assert(std::is_same_v<decltype(const_ptr_book.bid_begin()), typename BookType::const_bid_itertator>);
+    static_assert(std::is_same_v<decltype((*const_ptr_book.bid_begin()).second), const price_type&>);
+    static_assert(std::is_same_v<decltype((*const_ptr_book.bid_rbegin()).second), const price_type&>);
+    static_assert(std::is_same_v<decltype((*ptr_book.bid_begin()).second), price_type&>);
+    static_assert(std::is_convertible_v<typename BookType::bid_itertator, typename BookType::const_bid_itertator>);
+    static_assert(!std::is_convertible_v<typename BookType::const_bid_itertator, typename BookType::bid_itertator>);
+    const std::vector<price_type> const_levels = {mid_price + 3, mid_price - 1, mid_price - 14, mid_price - 30};
+    auto const_expected = const_levels.begin();
+    for(auto it = const_ptr_book.bid_begin(); it != const_ptr_book.bid_end(); ++it, ++const_expected)
+    {
+        test(it->first, *const_expected, "const iterator out of order", __LINE__);
+        test(&it->second == const_ptr_book.find_ptr(BookType::Side::BID, it->first), "const iterator should point into the book", __LINE__);
+    }
+    test(const_expected == const_levels.end(), "const iterator missed levels", __LINE__);
+    test(static_cast<size_t>(std::distance(const_ptr_book.bid_rbegin(), const_ptr_book.bid_rend())), const_levels.size(), "const reverse iterator failed", __LINE__);
+    test(std::prev(const_ptr_book.bid_end())->first, const_levels.back(), "const iterator decrement failed", __LINE__);
+    typename BookType::const_bid_itertator converted = ptr_book.bid_begin();
+    test(converted == const_ptr_book.bid_begin(), "iterator to const iterator failed", __LINE__);
+    test(ptr_book.bid_begin() == converted, "iterator and const iterator should compare", __LINE__);
+    test(std::next(converted, 4) == ptr_book.bid_end(), "const iterator end failed", __LINE__);
+    
+    //visitors stop at max_depth levels, or when the callable returns false
+    std::vector<price_type> visited_levels;
+    test(const_ptr_book.for_each_bid_level([&](price_type level, const price_type&) { visited_levels.push_back(level); }, 3), 3ul, "for_each_bid_level max_depth failed", __LINE__);
+    test(visited_levels == std::vector<price_type>(const_levels.begin(), const_levels.begin() + 3), "for_each_bid_level max_depth failed", __LINE__);
+    visited_levels.clear();
+    test(const_ptr_book.for_each_bid_level([&](price_type level, const price_type&)
+    {
+        visited_levels.push_back(level);
+        return level != mid_price - 1;
+    }), 2ul, "for_each_bid_level early exit failed", __LINE__);
+    test(visited_levels.back(), mid_price - 1, "for_each_bid_level early exit failed", __LINE__);
+    test(const_ptr_book.for_each_ask_level([](price_type, const price_type&) {}), 0ul, "for_each_ask_level of an empty side failed", __LINE__);
+    
+    //snapshots fill the caller's arrays with the best levels, stopping at the depth asked for or the smaller array
+    std::cout << "Testing snapshot..." << std::endl;
+    std::array<price_type, 8> snapshot_keys{}, snapshot_values{};
+    test(const_ptr_book.snapshot(BookType::Side::BID, 8, snapshot_keys, snapshot_values), const_levels.size(), "snapshot of the whole side failed", __LINE__);
+    for(size_t level = 0; level < const_levels.size(); ++level)
+    {
+        test(snapshot_keys[level], const_levels[level], "snapshot price failed", __LINE__);
+        test(snapshot_values[level], *const_ptr_book.find_ptr(BookType::Side::BID, const_levels[level]), "snapshot value failed", __LINE__);
+    }
+    snapshot_keys.fill(0);
+    test(const_ptr_book.template snapshot<BookType::Side::BID>(2, snapshot_keys, snapshot_values), 2ul, "snapshot depth failed", __LINE__);
+    test(snapshot_keys[1], const_levels[1], "snapshot depth failed", __LINE__);
+    test(snapshot_keys[2], 0ul, "snapshot wrote past its depth", __LINE__);
+    test(const_ptr_book.snapshot(BookType::Side::BID, 8, std::span(snapshot_keys).first(3), snapshot_values), 3ul, "snapshot should stop at the smaller array", __LINE__);
+    test(const_ptr_book.snapshot(BookType::Side::ASK, 8, snapshot_keys, snapshot_values), 0ul, "snapshot of an empty side failed", __LINE__);
+    
+    //level handles. no hashing after the first call, stale after a rehash
+    std::cout << "Testing level handles..." << std::endl;
+    BookType handle_book(mid_price);
+    std::vector<typename BookType::bid_level_handle> handles;
+    for(price_type level : {mid_price - 1, mid_price - 14, mid_price - 30, mid_price + 3}) //fast book, collision, overflow, crossed
+    {
+        handles.emplace_back();
+        test(handle_book.find_ptr(handles.back()) == nullptr, "a default handle should be stale", __LINE__);
+        test(handle_book.template insert<BookType::Side::BID>(price_type(level), price_type(5), handles.back()), "handle insert failed", __LINE__);
+        test(handles.back().key(), level, "handle key failed", __LINE__);
+    }
+    for(auto& handle : handles)
+    {
+        test(handle_book.update(handle, price_type(handle.key() + 1)), "handle update failed", __LINE__);
+        test(handle_book.find(BookType::Side::BID, handle.key(), upsert_volume), "handle update find failed", __LINE__);
+        test(upsert_volume, handle.key() + 1, "handle update failed", __LINE__);
+        test(handle_book.find_ptr(handle) == handle_book.find_ptr(BookType::Side::BID, handle.key()), "handle find_ptr failed", __LINE__);
+    }
+    //a shallower overflow level in the same bucket moves the deeper one along, the handle still finds it
+    const price_type deep_overflow = mid_price - 30 - BookType::fast_book_size_val;
+    typename BookType::bid_level_handle deep_handle;
+    test(handle_book.erase(handles[2]), "handle erase failed", __LINE__);
+    test(handle_book.template insert<BookType::Side::BID>(price_type(deep_overflow), price_type(9), deep_handle), "handle insert failed", __LINE__);
+    test(handle_book.insert(BookType::Side::BID, mid_price - 30, price_type(8)), "overflow insert failed", __LINE__);
+    test(*handle_book.find_ptr(deep_handle), 9ul, "moved overflow handle failed", __LINE__);
+    test(handle_book.update(deep_handle, price_type(10)), "moved overflow handle update failed", __LINE__);
+    test(handle_book.find(BookType::Side::BID, deep_overflow, upsert_volume), "moved overflow handle update failed", __LINE__);
+    test(upsert_volume, 10ul, "moved overflow handle update failed", __LINE__);
+    //erasing the best through a handle recovers the next best, and an erased level's handle finds nothing
+    test(handle_book.erase(handles[3]), "handle erase failed", __LINE__);
+    test_failure(handle_book.erase(handles[3]), "erased handle should be stale", __LINE__);
+    test_failure(handle_book.update(handles[3], price_type(1)), "erased handle should be stale", __LINE__);
+    test(handle_book.getBestBid(upsert_best, upsert_volume), "handle best failed", __LINE__);
+    test(upsert_best, mid_price - 1, "handle best not recovered", __LINE__);
+    test(handle_book.template find_handle<BookType::Side::BID>(mid_price - 30, handles[2]), "find_handle failed", __LINE__);
+    test(handle_book.find_ptr(handles[2]) != nullptr, "find_handle failed", __LINE__);
+    test_failure(handle_book.template find_handle<BookType::Side::BID>(mid_price - 2, handles[2]), "find_handle of a missing level failed", __LINE__);
+    //a rehash makes every handle stale
+    handle_book.rehash(mid_price + 1);
+    test(handle_book.find_ptr(handles[0]) == nullptr, "handle should be stale after a rehash", __LINE__);
+    test_failure(handle_book.update(handles[1], price_type(1)), "handle should be stale after a rehash", __LINE__);
+    test(handle_book.template find_handle<BookType::Side::BID>(mid_price - 14, handles[1]), "find_handle after a rehash failed", __LINE__);
+    test(handle_book.update(handles[1], price_type(2)), "handle update after a rehash failed", __LINE__);
+    test(handle_book.find(BookType::Side::BID, mid_price - 14, upsert_volume), "handle update after a rehash failed", __LINE__);
+    test(upsert_volume, 2ul, "handle update after a rehash failed", __LINE__);
+    
+    //moving and swapping hand the levels over. books can live in a std::vector
+    std::cout << "Testing move and swap..." << std::endl;
+    auto fill_book = [&](BookType& book, price_type levels)
+    {
+        for(price_type level = 1; level <= levels; ++level)
+        {
+            test(book.insert(BookType::Side::BID, mid_price - level, price_type(level)), "move insert failed", __LINE__);
+            test(book.insert(BookType::Side::ASK, mid_price + level, price_type(level)), "move insert failed", __LINE__);
+        }
+    };
+    auto test_book = [&](const BookType& book, price_type levels)
+    {
+        test(book.size(), static_cast<size_t>(2 * levels), "moved book size failed", __LINE__);
+        price_type expected_bid = mid_price - 1;
+        for(auto it = book.bid_begin(); it != book.bid_end(); ++it, --expected_bid)
+            test(it->first, expected_bid, "moved book iterator failed", __LINE__);
+        test(expected_bid, mid_price - 1 - levels, "moved book iterator failed", __LINE__);
+    };
+    BookType move_book(mid_price);
+    fill_book(move_book, 40);
+    BookType moved_book(std::move(move_book));
+    test_book(moved_book, 40);
+    test_book(move_book, 0);
+    fill_book(move_book, 3); //still usable after the move
+    test_book(move_book, 3);
+    swap(move_book, moved_book);
+    test_book(move_book, 40);
+    test_book(moved_book, 3);
+    moved_book = std::move(move_book);
+    test_book(moved_book, 40);
+    test(moved_book.bid_end() == move_book.bid_end(), "end iterators should compare equal", __LINE__);
+    std::vector<BookType> books;
+    for(price_type book = 1; book <= 5; ++book) //the vector reallocates along the way
+    {
+        books.emplace_back(mid_price);
+        fill_book(books.back(), book * 10);
+    }
+    for(price_type book = 1; book <= 5; ++book)
+        test_book(books[book - 1], book * 10);
+    std::cout << "All " << layout_name << " tests passed" << std::endl;
+}
+
+static void RunTests()
+{
+    using price_type = size_t;
+    const price_type tick_size = 1, mid_price = 110;
+    const size_t fast_book_size = 10, collision_buckets = 2;
+    using BookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets>;
+    using SplitBookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, false, split_layout>;
+    BookType order_book(mid_price);
+    SplitBookType split_order_book(mid_price);
+    using SideType = BookType::bid_book_type;
+    using SplitSideType = SplitBookType::bid_book_type;
+    std::cout << "What size are things?..." << std::endl;
+    std::cout << "size of one side: " << sizeof(SideType) << std::endl;
+    std::cout << "size of fast book (interleaved): " << sizeof(SideType::fast_block_type) << std::endl;
+    std::cout << "size of fast book (split): " << sizeof(SplitSideType::fast_block_type) << std::endl;
+    std::cout << "size of collision_bucket: " << sizeof(SideType::collision_bucket<3>) << std::endl;
+    std::cout << "size of overflow_bucket_type: " << sizeof(SideType::collision_bucket_type) << std::endl;
+    std::cout << "size of bucket_type: " << sizeof(SideType::bucket_type) << std::endl;
+    std::cout << "Cache line size: " << getCacheLineSize() << std::endl;
+    std::cout << "Size of static order_book: " << sizeof(order_book) << " bytes. Or "
+                << sizeof(order_book) / (double)getCacheLineSize() << " cache lines." << std::endl;
+    std::cout << "Size of book array: " << sizeof(order_book.bids()._buckets) << std::endl;
+    std::cout << "Total order_book size: " << order_book.getByteSize() << " bytes. Or "
+                << order_book.getByteSize() / getCacheLineSize() << " cache lines " << std::endl;
+    std::cout << "Total split order_book size: " << split_order_book.getByteSize() << " bytes. Or "
+                << split_order_book.getByteSize() / getCacheLineSize() << " cache lines " << std::endl;
+    std::cout << "Node size: " << sizeof(SideType::collision_bucket<collision_buckets>) << " padding: " << SideType::collision_bucket<collision_buckets>::padding_size << std::endl;
+    
+    //inline collision tier. the buckets only hold the overflow list, the collision levels sit after the fast book
+    using InlineBookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, false, inline_collisions<>>;
+    using InlineSideType = InlineBookType::bid_book_type;
+    InlineBookType inline_order_book(mid_price);
+    std::cout << "size of inline collision block: " << sizeof(InlineSideType::inline_block_type) << std::endl;
+    std::cout << "Total inline order_book size: " << inline_order_book.getByteSize() << " bytes. Or "
+                << inline_order_book.getByteSize() / getCacheLineSize() << " cache lines " << std::endl;
+    test(sizeof(InlineSideType::collision_bucket_type) < sizeof(SideType::collision_bucket_type), "Inline collision bucket should not hold a nodes pointer", __LINE__);
+    //with every collision level in use the inline tier is the smaller one, it doesn't pay for per bucket pointers
+    auto fill_collision_levels = [&](auto& book)
+    {
+        for(price_type level = 0; level < fast_book_size * collision_buckets; ++level)
+        {
+            test(book.insert(BookType::Side::ASK, mid_price + 5 + level, 1), "collision insert failed", __LINE__);
+            test(book.insert(BookType::Side::BID, mid_price - 6 - level, 1), "collision insert failed", __LINE__);
+        }
+    };
+    fill_collision_levels(order_book);
+    fill_collision_levels(inline_order_book);
+    test(inline_order_book.getByteSize() < order_book.getByteSize(), "Inline collision tier should not pay for per bucket pointers", __LINE__);
+    order_book.clear(mid_price);
+    inline_order_book.clear(mid_price);
+    
+    //collision blocks are allocated on first use and given back when empty, one spare is kept per side
+    std::cout << "Testing lazy collision blocks..." << std::endl;
+    BookType::ask_book_type lazy_asks(mid_price);
+    const size_t lazy_empty_size = lazy_asks.getByteSize();
+    const size_t lazy_block_size = sizeof(*lazy_asks._buckets[0].nodes);
+    test(lazy_asks._buckets[0].nodes == nullptr, "collision block allocated before use", __LINE__);
+    test(lazy_asks.insert(price_type(mid_price + 5), price_type(1)), "lazy insert failed", __LINE__);
+    test(lazy_asks.getByteSize(), lazy_empty_size + lazy_block_size, "collision block not allocated on insert", __LINE__);
+    test(lazy_asks.erase(mid_price + 5), "lazy erase failed", __LINE__);
+    test(lazy_asks._buckets[0].nodes == nullptr, "empty collision block not given back", __LINE__);
+    test(lazy_asks.getByteSize(), lazy_empty_size + lazy_block_size, "empty collision block should be the spare", __LINE__);
+    test(lazy_asks.insert(price_type(mid_price + 8), price_type(1)), "lazy insert failed", __LINE__);
+    test(lazy_asks.insert(price_type(mid_price + 18), price_type(1)), "lazy insert failed", __LINE__);
+    test(lazy_asks.getByteSize(), lazy_empty_size + lazy_block_size, "spare collision block not reused", __LINE__);
+    price_type lazy_volume = 0;
+    test(lazy_asks.find(mid_price + 18, lazy_volume), "lazy find failed", __LINE__);
+    test_failure(lazy_asks.find(mid_price + 9, lazy_volume), "lazy find in unallocated block failed", __LINE__);
+    test_failure(lazy_asks.erase(mid_price + 9), "lazy erase in unallocated block failed", __LINE__);
+    lazy_asks.clear();
+    test(lazy_asks.getByteSize(), lazy_empty_size + lazy_block_size, "clear should keep a spare collision block", __LINE__);
+    lazy_asks.shrink_to_fit();
+    test(lazy_asks.getByteSize(), lazy_empty_size, "shrink_to_fit failed", __LINE__);
+    
+    //summary bitmaps. 4096 levels x 9 tiers is three levels of hierarchy
+    std::cout << "Testing occupancy bitmap..." << std::endl;
+    using BitmapType = SideType::occupancy_bitmap<4096 * 9>;
+    auto bitmap = std::make_unique<BitmapType>();
+    test(bitmap->find_first(), 4096ul * 9, "empty bitmap failed", __LINE__);
+    for(size_t bit : {3ul, 5000ul, 36000ul})
+        bitmap->set(bit);
+    test(bitmap->find_first(), 3ul, "bitmap find failed", __LINE__);
+    test(bitmap->find_next(4), 5000ul, "bitmap find failed", __LINE__);
+    test(bitmap->find_next(5001), 36000ul, "bitmap find failed", __LINE__);
+    test(bitmap->find_next(36001), 4096ul * 9, "bitmap find failed", __LINE__);
+    bitmap->reset(5000);
+    test(bitmap->find_next(4), 36000ul, "bitmap reset failed", __LINE__);
+    test(bitmap->summary.test(5000 / 64) == false, "bitmap summary not reset", __LINE__);
+    bitmap->clear();
+    test(bitmap->find_first(), 4096ul * 9, "bitmap clear failed", __LINE__);
+    
+    //sparse deep book. the iterator jumps the gaps between levels
+    using DeepBookType = HashOrderBook<price_type, price_type, tick_size, 4096, 8>;
+    auto deep_book = std::make_unique<DeepBookType>(100000);
+    for(price_type ask : {100001ul, 102000ul, 120000ul, 130000ul})
+        test(deep_book->insert(DeepBookType::Side::ASK, std::move(ask), std::move(ask)), "deep insert failed", __LINE__);
+    size_t deep_levels = 0;
+    price_type last_ask = 0;
+    for(auto it = deep_book->ask_begin(); it != deep_book->ask_end(); ++it, ++deep_levels)
+    {
+        test(last_ask < it->first, "deep iterator out of order", __LINE__);
+        last_ask = it->first;
+    }
+    test(deep_levels, 4ul, "deep iterator failed", __LINE__);
+    
+    //power of two fast book and tick hash with shifts and masks. same answers as the divide path
+    std::cout << "Testing power of two hashing..." << std::endl;
+    using Pow2BookType = HashOrderBook<price_type, price_type, 4, 8, 2>;
+    using Pow2SideType = Pow2BookType::ask_book_type;
+    static_assert(Pow2BookType::fast_hashing, "power of two book should hash with shifts");
+    static_assert(!BookType::fast_hashing, "fast book size of 10 can't hash with shifts");
+    for(long depth = -50; depth < 50; ++depth)
+    {
+        const long floor_div = depth >= 0 ? depth / 8 : -((7 - depth) / 8);
+        test(Pow2SideType::_floor_div(depth), floor_div, "power of two floor div failed", __LINE__);
+        test(Pow2SideType::_positiveMod(depth), static_cast<size_t>(depth - floor_div * 8), "power of two mod failed", __LINE__);
+        test(SideType::_positiveMod(depth), static_cast<size_t>(((depth % 10) + 10) % 10), "mod failed", __LINE__);
+    }
+    //both sides over the same prices, so crossed, collision and overflow levels all get hashed
+    Pow2BookType::bid_book_type pow2_bids(400);
+    Pow2SideType pow2_asks(400);
+    for(price_type pow2_price = 300; pow2_price < 500; pow2_price += 4)
+    {
+        test(pow2_bids.insert(price_type(pow2_price), price_type(pow2_price)), "power of two insert failed", __LINE__);
+        test(pow2_asks.insert(price_type(pow2_price), price_type(pow2_price)), "power of two insert failed", __LINE__);
+    }
+    for(price_type pow2_price = 300; pow2_price < 500; pow2_price += 4)
+    {
+        price_type pow2_volume = 0;
+        test(pow2_bids.find(pow2_price, pow2_volume), "power of two find failed", __LINE__);
+        test(pow2_volume, pow2_price, "power of two find failed", __LINE__);
+        test(pow2_asks.erase(pow2_price), "power of two erase failed", __LINE__);
+    }
+    test(pow2_bids.size(), 50ul, "power of two size failed", __LINE__);
+    test(pow2_asks.size(), 0ul, "power of two size failed", __LINE__);
+    
+    //reciprocal divide. every non power of two book and tick size hashes without a divide instruction
+    std::cout << "Testing reciprocal divide..." << std::endl;
+    auto test_divider = [](auto divider, std::uint64_t divisor)
+    {
+        const std::uint64_t max = ~std::uint64_t(0);
+        for(std::uint64_t numerator : {0ul, 1ul, divisor - 1, divisor, divisor + 1, 123456789ul, max / 3, max - 1, max})
+            test(decltype(divider)::divide(numerator), numerator / divisor, "reciprocal divide failed", __LINE__);
+        for(std::uint64_t numerator = 0, step = 1; numerator < max / 2; numerator += step, step = step * 3 + 1)
+            test(decltype(divider)::divide(numerator), numerator / divisor, "reciprocal divide failed", __LINE__);
+    };
+    test_divider(reciprocal_divider<3>{}, 3);
+    test_divider(reciprocal_divider<5>{}, 5);
+    test_divider(reciprocal_divider<7>{}, 7);
+    test_divider(reciprocal_divider<10>{}, 10);
+    test_divider(reciprocal_divider<25>{}, 25);
+    test_divider(reciprocal_divider<64>{}, 64);
+    test_divider(reciprocal_divider<1000003>{}, 1000003);
+    test_divider(reciprocal_divider<(1ul << 63) + 1>{}, (1ul << 63) + 1);
+    
+    using TickBookType = HashOrderBook<price_type, price_type, 5, 10, 2>;
+    TickBookType tick_book(1000);
+    for(price_type tick_price = 975; tick_price < 1200; tick_price += 5)
+        test(tick_book.insert(TickBookType::Side::ASK, price_type(tick_price), price_type(tick_price)), "tick size insert failed", __LINE__);
+    price_type expected = 975;
+    for(auto it = tick_book.ask_begin(); it != tick_book.ask_end(); ++it, expected += 5)
+        test(it->first, expected, "tick size iterator failed", __LINE__);
+    test(expected, 1200ul, "tick size iterator failed", __LINE__);
+    //an off grid price can take over the slot of an erased level, its handle must not find the newcomer
+    TickBookType off_grid_book(1000);
+    typename TickBookType::ask_level_handle off_grid_handle;
+    test(off_grid_book.template insert<TickBookType::Side::ASK>(price_type(1000), price_type(1), off_grid_handle), "tick size handle insert failed", __LINE__);
+    test(off_grid_book.erase(TickBookType::Side::ASK, 1000), "tick size erase failed", __LINE__);
+    test(off_grid_book.insert(TickBookType::Side::ASK, price_type(1001), price_type(2)), "off grid insert failed", __LINE__);
+    test(off_grid_book.find_ptr(off_grid_handle) == nullptr, "handle found another price in its slot", __LINE__);
+    test_failure(off_grid_book.update(off_grid_handle, price_type(3)), "handle updated another price in its slot", __LINE__);
+    test_failure(off_grid_book.erase(off_grid_handle), "handle erased another price in its slot", __LINE__);
+    test(*off_grid_book.find_ptr(TickBookType::Side::ASK, 1001), 2ul, "off grid level changed through a stale handle", __LINE__);
+    //the same in the overflow, where an off grid price can take the erased level's collision index
+    typename TickBookType::ask_level_handle overflow_handle;
+    test(off_grid_book.template insert<TickBookType::Side::ASK>(price_type(1125), price_type(4), overflow_handle), "overflow handle insert failed", __LINE__);
+    test(off_grid_book.insert(TickBookType::Side::ASK, price_type(1200), price_type(5)), "overflow insert failed", __LINE__);
+    test(off_grid_book.erase(TickBookType::Side::ASK, 1001), "off grid erase failed", __LINE__);
+    test(off_grid_book.erase(TickBookType::Side::ASK, 1125), "overflow erase failed", __LINE__);
+    test(off_grid_book.insert(TickBookType::Side::ASK, price_type(1126), price_type(6)), "off grid overflow insert failed", __LINE__);
+    test(off_grid_book.find_ptr(overflow_handle) == nullptr, "overflow handle found another price", __LINE__);
+    test_failure(off_grid_book.update(overflow_handle, price_type(7)), "overflow handle updated another price", __LINE__);
+    test_failure(off_grid_book.erase(overflow_handle), "overflow handle erased another price", __LINE__);
+    test(off_grid_book.size(), 2ul, "off grid overflow size failed", __LINE__);
+    price_type off_grid_best = 0, off_grid_volume = 0;
+    test(off_grid_book.getBestOffer(off_grid_best, off_grid_volume), "off grid best offer failed", __LINE__);
+    test(off_grid_best, 1126ul, "off grid best offer failed", __LINE__);
+    test(off_grid_volume, 6ul, "off grid best offer failed", __LINE__);
+    
+    RunLayoutTests<interleaved_layout>("interleaved");
+    RunLayoutTests<split_layout>("split");
+    RunLayoutTests<inline_collisions<>>("inline interleaved");
+    RunLayoutTests<inline_collisions<split_layout>>("inline split");
+    RunLayoutTests<sentinel_levels<>>("sentinel interleaved");
+    RunLayoutTests<sentinel_levels<split_layout>>("sentinel split");
+    RunLayoutTests<inline_collisions<sentinel_levels<split_layout>>>("inline sentinel split");
+    RunLayoutTests<keyless_levels<>>("keyless");
+    RunLayoutTests<keyless_levels<sentinel_levels<>>>("keyless sentinel");
+    RunLayoutTests<inline_collisions<keyless_levels<sentinel_levels<>>>>("inline keyless sentinel");
+    
+    //sentinel levels. no engaged flag, so a slot is exactly a key and a value, and a 0 quantity is no level
+    std::cout << "Testing sentinel levels..." << std::endl;
+    using SentinelSideType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, false, sentinel_levels<>>::bid_book_type;
+    test(sizeof(SentinelSideType::fast_block_type), fast_book_size * (sizeof(price_type) + sizeof(price_type)), "sentinel slot should have no padding", __LINE__);
+    test(sizeof(SentinelSideType::fast_block_type) < sizeof(SideType::fast_block_type), "sentinel fast book should be smaller", __LINE__);
+    SentinelSideType sentinel_bids(mid_price);
+    test_failure(sentinel_bids.insert(110, 0), "zero quantity should not insert", __LINE__);
+    test(sentinel_bids.insert(110, 5), "sentinel insert failed", __LINE__);
+    test(sentinel_bids.insert(95, 6), "sentinel insert failed", __LINE__);
+    test(sentinel_bids.size(), 2ul, "sentinel size failed", __LINE__);
+    price_type sentinel_volume = 0;
+    //a level zeroed through find_ptr is still in the book until it is erased
+    for(price_type zeroed : {price_type(110), price_type(95)})
+    {
+        *sentinel_bids.find_ptr(zeroed) = 0;
+        test(sentinel_bids.erase(zeroed), "erase of a zeroed sentinel level failed", __LINE__);
+        test(sentinel_bids.size(), 1ul, "erase of a zeroed sentinel level failed", __LINE__);
+        test(sentinel_bids.insert(price_type(zeroed), price_type(7)), "reinsert of a zeroed sentinel level failed", __LINE__);
+        test(sentinel_bids.size(), 2ul, "reinsert of a zeroed sentinel level counted twice", __LINE__);
+        *sentinel_bids.find_ptr(zeroed) = 0;
+        test_failure(sentinel_bids.insert(price_type(zeroed), price_type(8)), "insert over a zeroed sentinel level should fail", __LINE__);
+        test(sentinel_bids.size(), 2ul, "insert over a zeroed sentinel level counted twice", __LINE__);
+        *sentinel_bids.find_ptr(zeroed) = zeroed == 110 ? 5 : 6;
+    }
+    //and moves with the rest of the book, in place or rebuilt
+    *sentinel_bids.find_ptr(95) = 0;
+    for(price_type rehash_mid : {price_type(115), price_type(110), price_type(200), price_type(110)})
+    {
+        sentinel_bids.rehash(rehash_mid);
+        test(sentinel_bids.size(), 2ul, "rehash lost a zeroed sentinel level", __LINE__);
+        sentinel_volume = 1;
+        test(sentinel_bids.find(95, sentinel_volume) && sentinel_volume == 0, "rehash lost a zeroed sentinel level", __LINE__);
+        test(static_cast<size_t>(std::distance(sentinel_bids.begin(), sentinel_bids.end())), 2ul, "rehash lost a zeroed sentinel level", __LINE__);
+    }
+    sentinel_bids.clear();
+    test_failure(sentinel_bids.find(110, sentinel_volume), "sentinel clear failed", __LINE__);
+    test_failure(sentinel_bids.find(95, sentinel_volume), "sentinel clear failed", __LINE__);
+    
+    //keyless levels. only values are stored in the fast book and collision buckets, prices are rebuilt from the depth
+    std::cout << "Testing keyless levels..." << std::endl;
+    using KeylessBookType = HashOrderBook<price_type, std::uint32_t, 5, fast_book_size, collision_buckets, false, keyless_levels<sentinel_levels<>>>;
+    using KeylessSideType = KeylessBookType::ask_book_type;
+    test(sizeof(KeylessSideType::fast_block_type), fast_book_size * sizeof(std::uint32_t), "keyless fast book should only hold values", __LINE__);
+    KeylessSideType keyless_asks(1000);
+    for(price_type keyless_price = 975; keyless_price < 1200; keyless_price += 5)
+        test(keyless_asks.insert(price_type(keyless_price), std::uint32_t(keyless_price)), "keyless insert failed", __LINE__);
+    price_type keyless_expected = 975;
+    for(auto it = keyless_asks.begin(); it != keyless_asks.end(); ++it, keyless_expected += 5)
+    {
+        test(it->first, keyless_expected, "keyless iterator failed", __LINE__);
+        test(static_cast<price_type>(it->second), keyless_expected, "keyless iterator failed", __LINE__);
+    }
+    test(keyless_expected, 1200ul, "keyless iterator failed", __LINE__);
+    bool off_grid_threw = false;
+    try { keyless_asks.insert(1002, 1); } catch(const std::runtime_error&) { off_grid_threw = true; }
+    test(off_grid_threw, "keyless insert off the tick grid should throw", __LINE__);
+    keyless_asks.rehash(1050);
+    std::uint32_t keyless_volume = 0;
+    test(keyless_asks.find(1000, keyless_volume), "keyless find after rehash failed", __LINE__);
+    test(keyless_volume, 1000u, "keyless find after rehash failed", __LINE__);
+    test(keyless_asks.best().value(), 975ul, "keyless best after rehash failed", __LINE__);
+    
+    //auto rehash. the mid walks well past the fast book and the hashing mid price follows it a few ticks per operation
+    std::cout << "Testing auto rehash..." << std::endl;
+    using AutoBookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, true>;
+    AutoBookType auto_book(mid_price);
+    auto_book.set_auto_rehash(0.2, 2);
+    for(price_type auto_mid = mid_price; auto_mid < mid_price + 200; ++auto_mid)
+    {
+        //the offer is lifted and replaced a tick higher, then a new best bid joins
+        test(auto_book.insert(AutoBookType::Side::ASK, price_type(auto_mid + 3), price_type(auto_mid)), "auto rehash insert failed", __LINE__);
+        if(auto_mid > mid_price)
+            test(auto_book.erase(AutoBookType::Side::ASK, auto_mid + 1), "auto rehash erase failed", __LINE__);
+        test(auto_book.insert(AutoBookType::Side::ASK, price_type(auto_mid + 2), price_type(auto_mid)), "auto rehash insert failed", __LINE__);
+        test(auto_book.erase(AutoBookType::Side::ASK, auto_mid + 3), "auto rehash erase failed", __LINE__);
+        test(auto_book.insert(AutoBookType::Side::BID, price_type(auto_mid), price_type(auto_mid)), "auto rehash insert failed", __LINE__);
+    }
+    test(auto_book.size(), 201ul, "auto rehash size failed", __LINE__);
+    test(auto_book.getMid(), mid_price + 200, "auto rehash mid failed", __LINE__);
+    const long auto_drift = auto_book.asks().ticks_from_hashing_mid(auto_book.getMid());
+    test(auto_drift > -3 && auto_drift < 3, "hashing mid price didn't follow the mid", __LINE__);
+    price_type auto_volume = 0;
+    test(auto_book.find(AutoBookType::Side::BID, mid_price + 100, auto_volume), "auto rehash find failed", __LINE__);
+    test(auto_volume, mid_price + 100, "auto rehash find failed", __LINE__);
+    price_type auto_expected = mid_price + 199;
+    for(auto it = auto_book.bid_begin(); it != auto_book.bid_end(); ++it, --auto_expected)
+        test(it->first, auto_expected, "auto rehash bid iterator failed", __LINE__);
+    test(auto_expected, mid_price - 1, "auto rehash bid iterator failed", __LINE__);
+    //a handle from insert is current after the insert's own auto rehash
+    AutoBookType auto_handle_book(mid_price);
+    auto_handle_book.set_auto_rehash(0.2, 2);
+    for(price_type auto_mid = mid_price; auto_mid < mid_price + 100; ++auto_mid)
+    {
+        typename AutoBookType::ask_level_handle ask_handle;
+        typename AutoBookType::bid_level_handle bid_handle;
+        test(auto_handle_book.template insert<AutoBookType::Side::ASK>(price_type(auto_mid + 2), price_type(auto_mid), ask_handle), "auto rehash handle insert failed", __LINE__);
+        test(auto_handle_book.find_ptr(ask_handle) != nullptr, "handle from an auto rehash insert is stale", __LINE__);
+        test(auto_handle_book.template insert<AutoBookType::Side::BID>(price_type(auto_mid), price_type(auto_mid), bid_handle), "auto rehash handle insert failed", __LINE__);
+        test(auto_handle_book.find_ptr(bid_handle) != nullptr, "handle from an auto rehash insert is stale", __LINE__);
+    }
+    test(auto_handle_book.bids().hashing_mid_price() != mid_price, "auto rehash handle book didn't recentre", __LINE__);
+    //a tick bigger than one and a hashing mid price off the prices' tick grid, as a computed mid usually is.
+    //each step still moves every level exactly one deep, so lookups keep finding them
+    using TickAutoBookType = HashOrderBook<long, long, 5, 16, 2, true>;
+    TickAutoBookType tick_auto_book(1002);
+    for(long tick_mid = 1000; tick_mid < 1480; tick_mid += 5)
+    {
+        test(tick_auto_book.insert(TickAutoBookType::Side::BID, long(tick_mid), long(tick_mid)), "off grid auto rehash insert failed", __LINE__);
+        test(tick_auto_book.insert(TickAutoBookType::Side::ASK, long(tick_mid + 10), long(tick_mid)), "off grid auto rehash insert failed", __LINE__);
+        if(tick_mid > 1000)
+            test(tick_auto_book.erase(TickAutoBookType::Side::ASK, tick_mid + 5), "off grid auto rehash erase failed", __LINE__);
+    }
+    test(tick_auto_book.bids().hashing_mid_price() != 1002, "off grid auto rehash didn't recentre", __LINE__);
+    test(tick_auto_book.size(), 97ul, "off grid auto rehash size failed", __LINE__);
+    for(long tick_price = 1000; tick_price < 1480; tick_price += 5)
+    {
+        long tick_volume = 0;
+        test(tick_auto_book.find(TickAutoBookType::Side::BID, tick_price, tick_volume), "off grid auto rehash lost a level", __LINE__);
+        test(tick_volume, tick_price, "off grid auto rehash find failed", __LINE__);
+    }
+    //a recentre step only makes the handles into the bucket it moved stale
+    SideType step_bids(mid_price);
+    std::vector<SideType::level_handle> step_handles(fast_book_size);
+    for(size_t depth = 0; depth < fast_book_size; ++depth)
+        test(step_bids.insert(price_type(mid_price - depth), price_type(depth + 1), step_handles[depth]), "recentre handle insert failed", __LINE__);
+    test(step_bids.recentre(mid_price - 1, 1), "recentre failed", __LINE__);
+    size_t stale_handles = 0;
+    for(size_t depth = 0; depth < fast_book_size; ++depth)
+    {
+        if(!step_bids.valid(step_handles[depth]))
+            ++stale_handles;
+        else
+            test(*step_bids.find_ptr(step_handles[depth]), price_type(depth + 1), "handle found the wrong level after a recentre", __LINE__);
+    }
+    test(stale_handles, 1ul, "recentre should only stale one bucket's handles", __LINE__);
+    
+    //a small rehash is done in place. the collision blocks aren't reallocated
+    std::cout << "Testing in place rehash..." << std::endl;
+    SideType ring_bids(mid_price);
+    for(price_type ring_price = mid_price + 5; ring_price > mid_price - 40; --ring_price)
+        test(ring_bids.insert(price_type(ring_price), price_type(ring_price)), "in place rehash insert failed", __LINE__);
+    std::array<const void*, fast_book_size> collision_storage;
+    for(size_t i = 0; i < fast_book_size; ++i)
+        collision_storage[i] = ring_bids._buckets[i].nodes.get();
+    ring_bids.rehash(mid_price - 2);
+    ring_bids.rehash(mid_price + 3);
+    test(ring_bids.hashing_mid_price(), mid_price + 3, "in place rehash failed", __LINE__);
+    for(size_t i = 0; i < fast_book_size; ++i)
+        test(collision_storage[i] == ring_bids._buckets[i].nodes.get(), "in place rehash reallocated a collision block", __LINE__);
+    price_type ring_expected = mid_price + 5;
+    for(auto it = ring_bids.begin(); it != ring_bids.end(); ++it, --ring_expected)
+        test(it->first, ring_expected, "in place rehash iterator failed", __LINE__);
+    test(ring_expected, mid_price - 40, "in place rehash iterator failed", __LINE__);
+    //a bigger tick with prices off the hashing mid price's grid. a rehash onto that grid is done in place, one off it rebuilds
+    using TickRingSideType = HashOrderBookSide<long, long, 3, 8, 2, BookSide::BID>;
+    TickRingSideType tick_ring_bids(1248);
+    for(long ring_price = 1258; ring_price > 1180; ring_price -= 3)
+        test(tick_ring_bids.insert(long(ring_price), long(ring_price)), "off grid in place rehash insert failed", __LINE__);
+    for(long rehash_mid : {1245l, 1254l, 1250l, 1236l})
+    {
+        tick_ring_bids.rehash(rehash_mid);
+        test(tick_ring_bids.hashing_mid_price(), rehash_mid, "off grid in place rehash failed", __LINE__);
+        test(tick_ring_bids.size(), 26ul, "off grid in place rehash size failed", __LINE__);
+        long tick_ring_expected = 1258;
+        for(auto it = tick_ring_bids.begin(); it != tick_ring_bids.end(); ++it, tick_ring_expected -= 3)
+        {
+            test(it->first, tick_ring_expected, "off grid in place rehash iterator failed", __LINE__);
+            long tick_ring_volume = 0;
+            test(tick_ring_bids.find(it->first, tick_ring_volume), "off grid in place rehash lost a level", __LINE__);
+        }
+        test(tick_ring_expected, 1180l, "off grid in place rehash iterator failed", __LINE__);
+    }
+    
+    //collision blocks and overflow buckets from a pre-faulted arena. freed blocks are reused
+    std::cout << "Testing arena allocation..." << std::endl;
+    using ArenaBookType = HashOrderBook<price_type, price_type, tick_size, fast_book_size, collision_buckets, false, interleaved_layout, std::pmr::polymorphic_allocator<std::byte>>;
+    arena_resource arena(1 << 16);
+    {
+        ArenaBookType arena_book(mid_price, &arena);
+        test(arena.used(), 0ul, "empty book shouldn't allocate", __LINE__);
+        for(price_type arena_price = mid_price - 50; arena_price < mid_price + 50; ++arena_price)
+        {
+            test(arena_book.insert(ArenaBookType::Side::BID, price_type(arena_price), price_type(arena_price)), "arena insert failed", __LINE__);
+            test(arena_book.insert(ArenaBookType::Side::ASK, price_type(arena_price), price_type(arena_price)), "arena insert failed", __LINE__);
+        }
+        test(arena.used() > 0, "collision blocks not from the arena", __LINE__);
+        //a rebuild allocates a whole new side. the second and third reuse what the one before gave back
+        arena_book.rehash(mid_price + 20);
+        arena_book.rehash(mid_price - 20);
+        const size_t arena_used = arena.used();
+        arena_book.rehash(mid_price + 20);
+        test(arena.used(), arena_used, "arena free blocks not reused", __LINE__);
+        test(arena_book.size(), 200ul, "arena size failed", __LINE__);
+        price_type arena_volume = 0;
+        test(arena_book.find(ArenaBookType::Side::ASK, mid_price - 50, arena_volume), "arena find failed", __LINE__);
+        test(arena_volume, mid_price - 50, "arena find failed", __LINE__);
+    }
+    //blocks of a page or more take their real size rather than the next power of two, and are reused
+    {
+        arena_resource large_arena(1 << 16);
+        void* large_block = large_arena.allocate(10000);
+        test(large_arena.used(), 10112ul, "large arena block should keep its size", __LINE__);
+        large_arena.deallocate(large_block, 10000);
+        void* smaller_block = large_arena.allocate(9000);
+        test(smaller_block == large_block, "large arena block not reused", __LINE__);
+        test(large_arena.used(), 10112ul, "large arena block not reused", __LINE__);
+        large_arena.deallocate(smaller_block, 9000);
+        void* small_block = large_arena.allocate(100);
+        test(large_arena.used(), 10112ul + 128, "small arena block should be a power of two", __LINE__);
+        large_arena.deallocate(small_block, 100);
+        //the tail left by reusing the large block for a smaller one isn't lost
+        void* tail_block = large_arena.allocate(1024);
+        test(tail_block == static_cast<void*>(static_cast<std::byte*>(large_block) + 9088), "split large block tail not reused", __LINE__);
+        test(large_arena.used(), 10112ul + 128, "split large block tail not reused", __LINE__);
+        large_arena.deallocate(tail_block, 1024);
+    }
+    
+    //a full arena falls through to upstream
+    arena_resource small_arena(64);
+    ArenaBookType small_arena_book(mid_price, &small_arena);
+    for(price_type arena_price = mid_price; arena_price < mid_price + 100; ++arena_price)
+        test(small_arena_book.insert(ArenaBookType::Side::ASK, price_type(arena_price), price_type(arena_price)), "full arena insert failed", __LINE__);
+    test(small_arena_book.size(), 100ul, "full arena size failed", __LINE__);
+    
+    //an arena on huge pages. the book itself goes in the arena too, so all of it sits on one or two pages
+    std::cout << "Testing huge page arena..." << std::endl;
+    huge_page_resource huge_pages;
+    {
+        arena_resource huge_arena(1 << 20, &huge_pages);
+        test(huge_pages.mapped_bytes(), huge_page_resource::huge_page_size, "huge page mapping failed", __LINE__);
+        std::pmr::polymorphic_allocator<std::byte> huge_allocator(&huge_arena);
+        auto* huge_book = huge_allocator.new_object<ArenaBookType>(mid_price); //the allocator is passed on to the book
+        for(price_type huge_price = mid_price - 50; huge_price < mid_price + 50; ++huge_price)
+            test(huge_book->insert(ArenaBookType::Side::ASK, price_type(huge_price), price_type(huge_price)), "huge page insert failed", __LINE__);
+        test(huge_book->getPageCount(huge_page_resource::huge_page_size) <= 2, "huge page book spread over too many pages", __LINE__);
+        test(huge_book->getPageCount(4096) >= huge_book->getPageCount(huge_page_resource::huge_page_size), "page count failed", __LINE__);
+        std::cout << "huge page kind: " << static_cast<int>(huge_pages.kind()) << " pages per book: " << huge_book->getPageCount(huge_pages.page_size()) << std::endl;
+        huge_allocator.delete_object(huge_book);
+    }
+    test(huge_pages.mapped_bytes(), 0ul, "huge pages not unmapped", __LINE__);
+    
+    //moves and swaps hand heap storage over by pointer, along with the allocator it came from
+    std::cout << "Testing move storage..." << std::endl;
+    {
+        arena_resource first_arena(1 << 16), second_arena(1 << 16);
+        ArenaBookType first_book(mid_price, &first_arena), second_book(mid_price, &second_arena);
+        for(price_type move_price = mid_price; move_price < mid_price + 40; ++move_price)
+            test(first_book.insert(ArenaBookType::Side::ASK, price_type(move_price), price_type(move_price)), "move insert failed", __LINE__);
+        const void* collision_block = first_book.asks()._buckets[0].nodes.get();
+        const void* overflow_nodes = first_book.asks()._buckets[0].overflow_bucket.nodes.data();
+        test(collision_block != nullptr && overflow_nodes != nullptr, "move test needs collision and overflow levels", __LINE__);
+        swap(first_book, second_book);
+        test(second_book.asks()._buckets[0].nodes.get() == collision_block, "swap copied a collision block", __LINE__);
+        test(second_book.asks()._buckets[0].overflow_bucket.nodes.data() == overflow_nodes, "swap copied an overflow bucket", __LINE__);
+        test(second_book.asks().get_allocator().resource() == &first_arena, "swap left the allocator behind", __LINE__);
+        ArenaBookType third_book(std::move(second_book));
+        test(third_book.asks()._buckets[0].nodes.get() == collision_block, "move copied a collision block", __LINE__);
+        test(third_book.size(), 40ul, "move size failed", __LINE__);
+        test(third_book.bids().get_allocator().resource() == &first_arena, "move left the allocator behind", __LINE__);
+        test(second_book.asks().get_allocator().resource() == &first_arena, "moved from book should keep its allocator", __LINE__);
+        test(second_book.insert(ArenaBookType::Side::ASK, mid_price + 30, 1), "insert after move failed", __LINE__);
+    }
+    
     std::cout << "All tests passed" << std::endl << std::endl;
 }
 
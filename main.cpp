@@ -12,5 +12,13 @@
 int main(int argc, const char * argv[]) {
     RunTests();
     RunBenchmarks();
+    RunHashBenchmarks();
+    RunConstructionBenchmarks();
+    RunPageFootprintBenchmarks();
+    RunUpsertBenchmarks();
+    RunHandleBenchmarks();
+    RunDepthWalkBenchmarks();
+    RunOverflowIndexBenchmarks();
+    RunSnapshotBenchmarks();
     return 0;
 }